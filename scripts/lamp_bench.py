@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+"""
+lamp_bench.py - Deterministic stroke generator benchmark for lamp
+
+Runs every component and glyph in a symbol library plus a fixed set of
+shape commands through `lamp --record /dev/null --stats --settle 0` and
+reports events, frames, writes, bytes and paced draw time for each case.
+Recording runs on lamp's virtual clock, so numbers only change when the
+generators do and the bench runs fine off device (build lamp for the host).
+
+Results can be appended to a history file (JSON lines). Each run is
+compared against the last entry there and cases that got more expensive
+are listed as regressions.
+"""
+
+import argparse
+import json
+import subprocess
+import sys
+import time
+from pathlib import Path
+from typing import Dict, List
+
+METRICS = ["events", "frames", "writes", "bytes", "sleep_us", "time_us"]
+
+# Shape commands lamp generates strokes for, at a small and a large size
+SHAPES = {
+    "circle_small": ["pen circle 700 900 40 40"],
+    "circle_large": ["pen circle 700 900 600 600"],
+    "ellipse": ["pen circle 700 900 500 200"],
+    "arc": ["pen arc 700 900 400 400 30 300"],
+    "bezier_quad": ["pen bezier 100 1500 700 100 1300 1500"],
+    "bezier_cubic": ["pen bezier 100 1500 400 100 1000 1800 1300 300"],
+    "roundedrectangle": ["pen roundedrectangle 200 200 1200 1600 80"],
+    "rectangle": ["pen rectangle 200 200 1200 1600"],
+    "line": ["pen line 100 100 1300 1700"],
+    "eraser_fill": ["eraser fill 300 300 800 500"],
+    "eraser_clear": ["eraser clear 0 0 1404 1872"],
+}
+
+def run_case(lamp: str, commands: List[str]) -> Dict[str, int]:
+    """Run commands through a recording lamp and return its total stats"""
+    result = subprocess.run(
+        [lamp, "--record", "/dev/null", "--stats", "--settle", "0"],
+        input="\n".join(commands) + "\n", capture_output=True, text=True)
+    if result.returncode != 0:
+        raise RuntimeError(result.stderr.strip())
+
+    for line in result.stderr.splitlines():
+        parts = line.split()
+        if len(parts) > 2 and parts[0] == "STATS" and parts[1] == "total":
+            fields = dict(p.split("=", 1) for p in parts[2:] if "=" in p)
+            return {m: int(fields.get(m, 0)) for m in METRICS}
+    raise RuntimeError("lamp printed no STATS total, is it built with --stats?")
+
+def library_cases(library_path: Path) -> Dict[str, List[str]]:
+    with open(library_path) as f:
+        library = json.load(f)
+    cases = {}
+    for name, entry in sorted(library.get("components", {}).items()):
+        cases[f"component:{name}"] = entry["commands"]
+    for name, entry in sorted(library.get("font", {}).items()):
+        cases[f"glyph:{name}"] = entry["commands"]
+    return cases
+
+def git_commit() -> str:
+    try:
+        return subprocess.run(["git", "rev-parse", "--short", "HEAD"], capture_output=True,
+                              text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return ""
+
+def last_entry(history: Path):
+    if not history.exists():
+        return None
+    last = None
+    with open(history) as f:
+        for line in f:
+            if line.strip():
+                last = json.loads(line)
+    return last
+
+def main():
+    parser = argparse.ArgumentParser(description="Benchmark lamp's stroke generators")
+    parser.add_argument("--lamp", default="lamp", help="lamp binary (default: lamp on PATH)")
+    parser.add_argument("--library", type=Path, help="symbol_library.json to take components and glyphs from")
+    parser.add_argument("--history", type=Path, help="append results to this JSON lines file and compare with its last entry")
+    parser.add_argument("--tolerance", type=float, default=0.0,
+                        help="percent a metric may grow before it counts as a regression (default: 0)")
+    parser.add_argument("--check", action="store_true", help="exit with 1 if anything regressed")
+    args = parser.parse_args()
+
+    cases = dict(SHAPES)
+    if args.library:
+        cases.update(library_cases(args.library))
+
+    results = {}
+    for name, commands in cases.items():
+        try:
+            results[name] = run_case(args.lamp, commands)
+        except (OSError, RuntimeError) as e:
+            print(f"Error: {name}: {e}", file=sys.stderr)
+            sys.exit(1)
+
+    print(f"{'case':<28}" + "".join(f"{m:>12}" for m in METRICS))
+    for name, r in results.items():
+        print(f"{name:<28}" + "".join(f"{r[m]:>12}" for m in METRICS))
+    totals = {m: sum(r[m] for r in results.values()) for m in METRICS}
+    print(f"{'total':<28}" + "".join(f"{totals[m]:>12}" for m in METRICS))
+
+    regressions = []
+    if args.history:
+        previous = last_entry(args.history)
+        if previous:
+            for name, r in results.items():
+                old = previous["results"].get(name)
+                if old is None:
+                    continue
+                for m in METRICS:
+                    if r[m] > old.get(m, 0) * (1 + args.tolerance / 100):
+                        regressions.append(f"{name} {m}: {old.get(m, 0)} -> {r[m]}")
+            print(f"\nCompared with {previous.get('commit') or 'the last run'} from {previous.get('time', '?')}:")
+            print("\n".join(f"  REGRESSION {r}" for r in regressions) if regressions else "  no regressions")
+
+        with open(args.history, "a") as f:
+            f.write(json.dumps({"time": time.strftime("%Y-%m-%d %H:%M:%S"), "commit": git_commit(),
+                                "results": results}) + "\n")
+
+    if args.check and regressions:
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
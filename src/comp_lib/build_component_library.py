@@ -1,14 +1,58 @@
 #!/usr/bin/env python3
 """
 build_component_library.py - Build complete component and font library
-Creates JSON library with lamp pen commands for all SVG assets
+Creates JSON library with lamp pen commands for all SVG assets, plus a
+compiled binary copy that lamp can mmap for its `place` command
 """
 
 import sys
 import json
+import math
+import struct
+import os
+import shutil
 import subprocess
 from pathlib import Path
-from typing import Dict, List
+from typing import Dict, List, Tuple
+
+# Binary library layout (little endian, shared with lamp/library.cpy):
+#   header:  magic "LMPL", u16 version, u16 entry count, u32 data offset, u32 file size
+#   entries: char name[24], u8 kind, u8 reserved, u16 stroke count, u32 offset,
+#            i16 min_x, min_y, max_x, max_y   (sorted by kind, then name)
+#   strokes: u16 point count, i16 x0, y0, then (count - 1) i16 dx, dy deltas
+#   metrics: the "font" entry of kind 2, see font_metrics
+LIBRARY_MAGIC = b"LMPL"
+LIBRARY_VERSION = 1
+LIBRARY_NAME_LEN = 24
+LIBRARY_HEADER = struct.Struct("<4sHHII")
+LIBRARY_ENTRY = struct.Struct("<24sBBHIhhhh")
+KIND_COMPONENT = 0
+KIND_GLYPH = 1
+KIND_METRICS = 2
+
+# Glyphs are profiled in this many horizontal bands for kerning
+KERN_BANDS = 8
+
+# Stroke ordering: ends closer than this (display px) are one polyline, and
+# 2-opt gives up after this many passes over a component
+JOIN_TOLERANCE = 2
+MAX_2OPT_PASSES = 50
+
+# Joined strokes are simplified to within this many display px, and the
+# simplifier window, both as in lamp/simplify.cpy
+SIMPLIFY_TOLERANCE = 0.5
+SIMPLIFY_WINDOW = 64
+
+def find_native_compiler():
+    """svg_compile binary (src/svg_compile) if one is built, see its README"""
+    path = os.environ.get("SVG_COMPILE")
+    if path is not None:
+        # An empty SVG_COMPILE forces the Python pipeline
+        return path if path and os.access(path, os.X_OK) else None
+    built = Path(__file__).resolve().parent.parent / "svg_compile" / "svg_compile"
+    if os.access(built, os.X_OK):
+        return str(built)
+    return shutil.which("svg_compile")
 
 def svg_to_lamp_commands(svg_path: Path, scale: int = 1, x: int = 0, y: int = 0, tolerance: float = 1.0) -> List[str]:
     """Convert SVG to lamp pen commands using svg_to_lamp.sh"""
@@ -37,6 +81,171 @@ def svg_to_lamp_commands(svg_path: Path, scale: int = 1, x: int = 0, y: int = 0,
         print(f"Error converting {svg_path.name}: {e.stderr}", file=sys.stderr)
         return []
 
+def pen_ups(commands: List[str]) -> int:
+    return sum(1 for cmd in commands if cmd == "pen up")
+
+def simplify_stroke(points: List[Tuple[int, int]], tolerance: float = SIMPLIFY_TOLERANCE) -> List[Tuple[int, int]]:
+    """Douglas-Peucker a stroke the way lamp's streaming Simplifier does.
+
+    A port of lamp/simplify.cpy (windowed, and with the same integer and
+    float operations) so library strokes come out point for point as if
+    lamp had simplified them itself. Keep the two in step.
+    """
+    if not points:
+        return []
+    limit = tolerance * tolerance
+    out = [points[0]]
+    win = [points[0]]
+
+    def distance(i, a, b):
+        dx, dy = win[b][0] - win[a][0], win[b][1] - win[a][1]
+        px, py = win[i][0] - win[a][0], win[i][1] - win[a][1]
+        len2 = dx * dx + dy * dy
+        t = px * dx + py * dy
+        if len2 == 0 or t <= 0:
+            return float(px * px + py * py)
+        if t >= len2:
+            qx, qy = win[i][0] - win[b][0], win[i][1] - win[b][1]
+            return float(qx * qx + qy * qy)
+        c = px * dy - py * dx
+        return float(c * c) / float(len2)
+
+    def simplify():
+        keep = [False] * len(win)
+        keep[0] = keep[-1] = True
+        stack = [(0, len(win) - 1)]
+        while stack:
+            a, b = stack.pop()
+            far, far_d = -1, limit
+            for i in range(a + 1, b):
+                d = distance(i, a, b)
+                if d > far_d:
+                    far, far_d = i, d
+            if far < 0:
+                continue
+            keep[far] = True
+            stack.append((far, b))
+            stack.append((a, far))
+        return keep
+
+    for p in points[1:]:
+        if p == win[-1]:
+            continue
+        win.append(p)
+        if len(win) < SIMPLIFY_WINDOW:
+            continue
+        keep = simplify()
+        kept = [i for i in range(1, len(win) - 1) if keep[i]]
+        if not kept or len(win) - 1 - kept[-1] > SIMPLIFY_WINDOW // 2:
+            out.extend(win[i] for i in kept)
+            out.append(win[-1])
+            win = win[-1:]
+        else:
+            out.extend(win[i] for i in kept)
+            win = win[kept[-1]:]
+    if len(win) > 1:
+        keep = simplify()
+        out.extend(win[i] for i in range(1, len(win)) if keep[i])
+    return out
+
+def optimize_strokes(commands: List[str]) -> List[str]:
+    """Reorder a component's pen strokes to cut pen lifts and travel.
+
+    Strokes whose ends meet are joined into one polyline (reversing one
+    of them if needed). Joined strokes are then simplified with
+    simplify_stroke(), ordered nearest first from the first stroke and
+    improved with 2-opt, which may also reverse strokes. Commands other
+    than pen down/move/up keep their order after the strokes.
+    """
+    strokes = []
+    others = []
+    current = []
+    for cmd in commands:
+        parts = cmd.split()
+        if len(parts) >= 4 and parts[0] == "pen" and parts[1] in ("down", "move"):
+            if parts[1] == "down" and current:
+                strokes.append(current)
+                current = []
+            current.append((int(parts[2]), int(parts[3])))
+        elif cmd == "pen up":
+            if current:
+                strokes.append(current)
+            current = []
+        else:
+            others.append(cmd)
+    if current:
+        strokes.append(current)
+
+    def near(a, b):
+        return abs(a[0] - b[0]) <= JOIN_TOLERANCE and abs(a[1] - b[1]) <= JOIN_TOLERANCE
+
+    # Join strokes end to end until no two ends meet
+    joined = True
+    while joined:
+        joined = False
+        for i in range(len(strokes)):
+            for j in range(len(strokes)):
+                if i == j:
+                    continue
+                a, b = strokes[i], strokes[j]
+                if near(a[-1], b[0]):
+                    strokes[i] = a + b[1:]
+                elif near(a[-1], b[-1]):
+                    strokes[i] = a + b[-2::-1]
+                elif near(a[0], b[-1]):
+                    strokes[i] = b + a[1:]
+                elif near(a[0], b[0]):
+                    strokes[i] = b[::-1] + a[1:]
+                else:
+                    continue
+                del strokes[j]
+                joined = True
+                break
+            if joined:
+                break
+    strokes = [simplify_stroke(stroke) for stroke in strokes]
+
+    def dist(a, b):
+        return math.hypot(a[0] - b[0], a[1] - b[1])
+
+    # Nearest end first
+    order = []
+    if strokes:
+        left = strokes[1:]
+        order.append(strokes[0])
+        while left:
+            pos = order[-1][-1]
+            best = min(range(len(left)), key=lambda k: min(dist(pos, left[k][0]), dist(pos, left[k][-1])))
+            stroke = left.pop(best)
+            order.append(stroke if dist(pos, stroke[0]) <= dist(pos, stroke[-1]) else stroke[::-1])
+
+    # 2-opt: reversing order[i..j] (and every stroke in it) swaps the travel
+    # into i and out of j for travel into j's end and out of i's start
+    for _ in range(MAX_2OPT_PASSES):
+        improved = False
+        for i in range(len(order)):
+            for j in range(i, len(order)):
+                old = new = 0.0
+                if i > 0:
+                    old += dist(order[i - 1][-1], order[i][0])
+                    new += dist(order[i - 1][-1], order[j][-1])
+                if j + 1 < len(order):
+                    old += dist(order[j][-1], order[j + 1][0])
+                    new += dist(order[i][0], order[j + 1][0])
+                if new < old - 1e-9:
+                    order[i:j + 1] = [stroke[::-1] for stroke in reversed(order[i:j + 1])]
+                    improved = True
+        if not improved:
+            break
+
+    out = []
+    for stroke in order:
+        out.append(f"pen down {stroke[0][0]} {stroke[0][1]}")
+        for x, y in stroke[1:]:
+            out.append(f"pen move {x} {y}")
+        out.append("pen up")
+    return out + others
+
 def build_component_library(components_dir: Path) -> Dict:
     """Build library from components directory"""
     library = {}
@@ -56,13 +265,15 @@ def build_component_library(components_dir: Path) -> Dict:
         commands = svg_to_lamp_commands(svg_file, scale=1, tolerance=1.0)
         
         if commands:
+            before = pen_ups(commands)
+            commands = optimize_strokes(commands)
             library[component_name] = {
                 "type": "component",
                 "source": str(svg_file.name),
                 "commands": commands,
                 "command_count": len(commands)
             }
-            print(f"✓ ({len(commands)} commands)")
+            print(f"✓ ({len(commands)} commands, pen ups {before} -> {pen_ups(commands)})")
         else:
             print(f"✗ (failed)")
     
@@ -94,6 +305,8 @@ def build_font_library(font_dir: Path) -> Dict:
         commands = svg_to_lamp_commands(svg_file, scale=1, tolerance=1.5)
         
         if commands:
+            before = pen_ups(commands)
+            commands = optimize_strokes(commands)
             library[char] = {
                 "type": "glyph",
                 "char": char,
@@ -101,12 +314,156 @@ def build_font_library(font_dir: Path) -> Dict:
                 "commands": commands,
                 "command_count": len(commands)
             }
-            print(f"✓ ({len(commands)} commands)")
+            print(f"✓ ({len(commands)} commands, pen ups {before} -> {pen_ups(commands)})")
         else:
             print(f"✗ (failed)")
     
     return library
 
+def circle_points(cx: float, cy: float, r: float) -> List[Tuple[int, int]]:
+    """Closed polygon for a `pen circle`, roughly one vertex per 8px of arc"""
+    n = max(12, min(90, int(2 * math.pi * r / 8)))
+    return [(int(round(cx + r * math.cos(2 * math.pi * i / n))),
+             int(round(cy + r * math.sin(2 * math.pi * i / n)))) for i in range(n + 1)]
+
+def commands_to_strokes(commands: List[str]) -> List[List[Tuple[int, int]]]:
+    """Flatten lamp pen commands into polylines, one per pen down/up"""
+    strokes = []
+    current = []
+
+    for cmd in commands:
+        parts = cmd.split()
+        if len(parts) < 2 or parts[0] != "pen":
+            continue
+
+        action = parts[1]
+        args = [float(p) for p in parts[2:]]
+
+        if action == "down" and len(args) >= 2:
+            if len(current) > 1:
+                strokes.append(current)
+            current = [(int(args[0]), int(args[1]))]
+        elif action == "move" and len(args) >= 2:
+            current.append((int(args[0]), int(args[1])))
+        elif action == "up":
+            if len(current) > 1:
+                strokes.append(current)
+            current = []
+        elif action == "line" and len(args) >= 4:
+            strokes.append([(int(args[0]), int(args[1])), (int(args[2]), int(args[3]))])
+        elif action == "rectangle" and len(args) >= 4:
+            x1, y1, x2, y2 = (int(a) for a in args[:4])
+            strokes.append([(x1, y1), (x1, y2), (x2, y2), (x2, y1), (x1, y1)])
+        elif action == "circle" and len(args) >= 3:
+            strokes.append(circle_points(args[0], args[1], args[2]))
+
+    if len(current) > 1:
+        strokes.append(current)
+    return strokes
+
+def encode_strokes(strokes: List[List[Tuple[int, int]]]) -> bytes:
+    """Delta encode polylines as int16 point streams"""
+    out = bytearray()
+    for stroke in strokes:
+        out += struct.pack("<Hhh", len(stroke), stroke[0][0], stroke[0][1])
+        px, py = stroke[0]
+        for x, y in stroke[1:]:
+            out += struct.pack("<hh", x - px, y - py)
+            px, py = x, y
+    return bytes(out)
+
+def font_metrics(glyphs: List[List[List[Tuple[int, int]]]]) -> bytes:
+    """Spacing table for lamp's `text`, in glyph units.
+
+    u16 glyph count, i16 space advance, an i16 advance per glyph and an
+    i16 kerning matrix (row is the left glyph), glyphs in the order of the
+    library's glyph entries. The advance is the glyph's width plus a gap of
+    3/20 of the font's height. Each glyph's ink is profiled in KERN_BANDS
+    bands over that height, and a pair moves closer by the room between the
+    left glyph's right profile and the right glyph's left profile in the
+    same or a neighbouring band, at most half the gap. Integer math only,
+    svg_compile writes the same bytes.
+    """
+    ys = [y for strokes in glyphs for stroke in strokes for _, y in stroke]
+    top = min(ys)
+    height = max(ys) - top + 1
+    gap = height * 3 // 20
+    space = height // 2
+
+    profiles = []
+    for strokes in glyphs:
+        left = [None] * KERN_BANDS
+        right = [None] * KERN_BANDS
+        for stroke in strokes:
+            for (x0, y0), (x1, y1) in zip(stroke, stroke[1:] or stroke):
+                for b in range((min(y0, y1) - top) * KERN_BANDS // height,
+                               (max(y0, y1) - top) * KERN_BANDS // height + 1):
+                    left[b] = min(x0, x1) if left[b] is None else min(left[b], x0, x1)
+                    right[b] = max(x0, x1) if right[b] is None else max(right[b], x0, x1)
+        xs = [x for stroke in strokes for x, _ in stroke]
+        profiles.append((min(xs), max(xs), left, right))
+
+    out = bytearray(struct.pack("<Hh", len(glyphs), space))
+    for lo, hi, _, _ in profiles:
+        out += struct.pack("<h", hi - lo + gap)
+    for _, a_hi, _, a_right in profiles:
+        for b_lo, _, b_left, _ in profiles:
+            room = gap // 2
+            for i in range(KERN_BANDS):
+                for j in range(max(0, i - 1), min(KERN_BANDS, i + 2)):
+                    if a_right[i] is not None and b_left[j] is not None:
+                        room = min(room, a_hi - a_right[i] + b_left[j] - b_lo)
+            out += struct.pack("<h", -room)
+    return bytes(out)
+
+def write_binary_library(components: Dict, font: Dict, output_path: Path):
+    """Write the compiled stroke library lamp mmaps for `place`"""
+    entries = []
+    for kind, table in ((KIND_COMPONENT, components), (KIND_GLYPH, font)):
+        for name, entry in table.items():
+            encoded = name.encode("utf-8")
+            if len(encoded) >= LIBRARY_NAME_LEN:
+                print(f"Warning: name too long for binary library: {name}", file=sys.stderr)
+                continue
+            strokes = commands_to_strokes(entry["commands"])
+            if not strokes:
+                continue
+            entries.append((kind, encoded, strokes))
+
+    entries.sort(key=lambda e: (e[0], e[1]))
+    glyphs = [strokes for kind, _, strokes in entries if kind == KIND_GLYPH]
+
+    data_offset = LIBRARY_HEADER.size + LIBRARY_ENTRY.size * (len(entries) + (1 if glyphs else 0))
+    table = bytearray()
+    data = bytearray()
+    for kind, encoded, strokes in entries:
+        xs = [x for stroke in strokes for x, _ in stroke]
+        ys = [y for stroke in strokes for _, y in stroke]
+        table += LIBRARY_ENTRY.pack(encoded, kind, 0, len(strokes), data_offset + len(data),
+                                    min(xs), min(ys), max(xs), max(ys))
+        data += encode_strokes(strokes)
+
+    # Sorts after every glyph, it has the highest kind
+    if glyphs:
+        xs = [x for strokes in glyphs for stroke in strokes for x, _ in stroke]
+        ys = [y for strokes in glyphs for stroke in strokes for _, y in stroke]
+        table += LIBRARY_ENTRY.pack(b"font", KIND_METRICS, 0, 0, data_offset + len(data),
+                                    min(xs), min(ys), max(xs), max(ys))
+        data += font_metrics(glyphs)
+        entries.append((KIND_METRICS, b"font", []))
+
+    size = data_offset + len(data)
+    # Renamed over the old file so a lamp that has it mapped keeps reading
+    # valid data until it notices the rebuild and maps the new one
+    tmp_path = output_path.with_name(f"{output_path.name}.tmp{os.getpid()}")
+    with open(tmp_path, 'wb') as f:
+        f.write(LIBRARY_HEADER.pack(LIBRARY_MAGIC, LIBRARY_VERSION, len(entries), data_offset, size))
+        f.write(table)
+        f.write(data)
+    os.replace(tmp_path, output_path)
+
+    return len(entries), size
+
 def main():
     if len(sys.argv) < 4:
         print("Usage: python3 build_component_library.py <components_dir> <font_dir> <output.json>")
@@ -131,6 +488,12 @@ def main():
     print("=" * 60)
     print()
     
+    # The native compiler converts in parallel and only rebuilds changed SVGs
+    native = find_native_compiler()
+    if native:
+        print(f"Using native compiler: {native}")
+        sys.exit(subprocess.run([native, str(components_dir), str(font_dir), str(output_path)]).returncode)
+    
     # Build components
     print("COMPONENTS:")
     components = build_component_library(components_dir)
@@ -156,8 +519,13 @@ def main():
     with open(output_path, 'w') as f:
         json.dump(library, f, indent=2)
     
+    # Compiled copy for lamp's place command
+    binary_path = output_path.with_suffix(".bin")
+    entry_count, binary_size = write_binary_library(components, font, binary_path)
+    
     print("=" * 60)
     print(f"Library saved to: {output_path}")
+    print(f"Binary library saved to: {binary_path} ({entry_count} entries, {binary_size} bytes)")
     print(f"Components: {len(components)}")
     print(f"Glyphs: {len(font)}")
     print(f"Total entries: {len(components) + len(font)}")
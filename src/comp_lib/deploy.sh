@@ -80,6 +80,8 @@ ssh root@$RM2_IP "mkdir -p /opt/bin /opt/etc"
 echo -e "${BLUE}Deploying library...${NC}"
 scp -q "$SCRIPT_DIR/symbol_library.json" root@$RM2_IP:/opt/etc/
 echo -e "${GREEN}✓ symbol_library.json${NC}"
+scp -q "$SCRIPT_DIR/symbol_library.bin" root@$RM2_IP:/opt/etc/
+echo -e "${GREEN}✓ symbol_library.bin${NC}"
 
 echo -e "${BLUE}Deploying mode manager...${NC}"
 scp -q "$SRC_DIR/symbol_ui_mode.py" root@$RM2_IP:/opt/bin/symbol_ui_mode
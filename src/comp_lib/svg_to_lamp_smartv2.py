@@ -3,7 +3,7 @@
 svg_to_lamp_smart.py
 Intelligent SVG parser that distinguishes between straight lines and curves
 - Lines: outputs only endpoints (2 commands)
-- Curves: samples appropriately based on curvature
+- Curves: samples to a fixed chord error in display pixels
 - Result: Minimal pen commands for clean rendering
 - Optional: --show-pins flag to visualize anchor points
 """
@@ -18,6 +18,31 @@ import math
 SCREEN_WIDTH = 1404
 SCREEN_HEIGHT = 1872
 
+# Curve flattening. These mirror arc_segments()/bezier_segments() in
+# resources/rmkit/src/lamp/flatten.cpy, keep the two in sync.
+FLATTEN_TOLERANCE = 0.5     # max chord error in display pixels
+FLATTEN_MAX_SEGMENTS = 512
+
+def clamp_segments(n):
+    if n < 1:
+        return 1
+    return min(FLATTEN_MAX_SEGMENTS, int(math.ceil(n)))
+
+def arc_segments(r, sweep, tol=FLATTEN_TOLERANCE):
+    """Chords needed so each one's sagitta stays under tol (sweep in radians)"""
+    sweep = abs(sweep)
+    if r <= tol:
+        return clamp_segments(sweep / (math.pi / 2))
+    return clamp_segments(sweep / (2 * math.acos(1 - tol / r)))
+
+def bezier_segments(points, tol=FLATTEN_TOLERANCE):
+    """Wang's formula: equal parameter steps within tol of a bezier's chords"""
+    m = 0.0
+    for p0, p1, p2 in zip(points, points[1:], points[2:]):
+        m = max(m, abs(p0 - 2 * p1 + p2))
+    d = len(points) - 1
+    return clamp_segments(math.sqrt(d * (d - 1) / 8.0 * m / tol))
+
 def is_collinear(p1, p2, p3, tolerance=1e-3):
     """Check if three points are collinear (on same straight line)"""
     x1, y1 = p1
@@ -28,7 +53,11 @@ def is_collinear(p1, p2, p3, tolerance=1e-3):
     return cross < tolerance
 
 def simplify_points(points, tolerance=1.0):
-    """Remove redundant collinear points using Douglas-Peucker-like algorithm"""
+    """Remove points collinear (within tolerance) with their neighbours.
+
+    A single greedy pass, not Douglas-Peucker; build_component_library.py
+    simplify_stroke() runs that on the strokes afterwards.
+    """
     if len(points) <= 2:
         return points
     
@@ -42,21 +71,25 @@ def simplify_points(points, tolerance=1.0):
     simplified.append(points[-1])
     return simplified
 
-def smart_sample_segment(seg, tolerance=1.0):
+def smart_sample_segment(seg, tolerance=1.0, max_error=FLATTEN_TOLERANCE):
     """
     Intelligently sample a path segment:
     - Line: return only endpoints
-    - Curve: sample based on curvature, then simplify
+    - Curve: sample so no chord strays more than max_error (in SVG units)
+      from the curve, then simplify
     """
     if isinstance(seg, Line):
         # Straight line: only need start and end
         return [(seg.start.real, seg.start.imag), (seg.end.real, seg.end.imag)]
     
+    if isinstance(seg, (QuadraticBezier, CubicBezier)):
+        n = bezier_segments(seg.bpoints(), max_error)
+    elif isinstance(seg, Arc):
+        r = max(abs(seg.radius.real), abs(seg.radius.imag))
+        n = arc_segments(r, math.radians(seg.delta), max_error)
     else:
-        # Curve: sample and simplify
+        # Unknown curve: fall back to sampling by length
         seg_len = seg.length(error=1e-5)
-        
-        # Adaptive sampling based on segment length
         if seg_len < 10:
             n = 3
         elif seg_len < 50:
@@ -65,17 +98,17 @@ def smart_sample_segment(seg, tolerance=1.0):
             n = 8
         else:
             n = max(8, min(20, int(seg_len * 0.1)))
-        
-        points = []
-        for i in range(n + 1):
-            t = i / n
-            p = seg.point(t)
-            points.append((p.real, p.imag))
-        
-        # Simplify to remove collinear points
-        return simplify_points(points, tolerance)
 
-def smart_parse_path(d, tolerance=1.0):
+    points = []
+    for i in range(n + 1):
+        t = i / n
+        p = seg.point(t)
+        points.append((p.real, p.imag))
+
+    # Simplify to remove collinear points
+    return simplify_points(points, tolerance)
+
+def smart_parse_path(d, tolerance=1.0, max_error=FLATTEN_TOLERANCE):
     """
     Parse SVG path with intelligent sampling:
     - Detects lines vs curves
@@ -86,7 +119,7 @@ def smart_parse_path(d, tolerance=1.0):
     all_points = []
     
     for seg in sp:
-        seg_points = smart_sample_segment(seg, tolerance)
+        seg_points = smart_sample_segment(seg, tolerance, max_error)
         
         # Avoid duplicate points between segments
         if all_points and seg_points:
@@ -279,7 +312,7 @@ def main():
                 continue
             
             try:
-                pts = smart_parse_path(d, tolerance)
+                pts = smart_parse_path(d, tolerance, FLATTEN_TOLERANCE / scale)
                 if not pts:
                     continue
                 
@@ -7,7 +7,10 @@ Updated for conflict-free gesture operation with proper zones
 
 import sys
 import json
+import math
 import subprocess
+import time
+from collections import OrderedDict
 from pathlib import Path
 from typing import Dict, List, Tuple, Optional
 from dataclasses import dataclass, field
@@ -31,16 +34,63 @@ UI_VISIBLE_ITEMS = 16  # More items visible
 UI_TEXT_SCALE = 4      # Larger text
 UI_MARGIN = 30         # Bigger margins
 
+# Columns inside the panel, kept apart so rows and the scroll indicator can
+# be erased without touching each other or the panel border
+UI_ROW_X1 = UI_PANEL_X + 5
+UI_ROW_X2 = SCREEN_WIDTH - 25
+UI_INDICATOR_X1 = SCREEN_WIDTH - 20
+UI_INDICATOR_X2 = SCREEN_WIDTH - 10
+
+# Palette chrome is painted straight into the framebuffer by lamp's fb
+# commands (one partial refresh, nothing inked into the notebook). That needs
+# rm2fb on the rM2, SYMBOL_UI_OVERLAY=0 falls back to drawing with the pen.
+UI_OVERLAY = os.environ.get("SYMBOL_UI_OVERLAY", "1") != "0"
+UI_FONT_SIZE = 48
+
+# Placed strokes are indexed on a uniform grid of this many px so undo only
+# looks at the components near the one it takes back
+INDEX_CELL = 128
+# Half the width the eraser wipes (lamp's ERASE_FILL_SPACING) plus the pen's,
+# strokes this close to an erased one may have lost ink
+ERASE_MARGIN = 8
+
+# Transformed components kept in memory, least recently used go first. Scale
+# moves in quarters and rotation in quadrants, so a drawing rarely needs more
+SHAPE_CACHE_SIZE = 64
+
+def lround(v: float) -> int:
+    """Round half away from zero like C's lround, so points match lamp's"""
+    return int(v + 0.5) if v >= 0 else -int(0.5 - v)
+
+def monotonic_us() -> int:
+    return time.monotonic_ns() // 1000
+
+# genie_lamp passes a trace id in LAMP_TRACE, our own stages go to lamp as
+# trace lines on it: "start" is as early as Python lets us measure
+TRACE_ID = os.environ.get("LAMP_TRACE", "").split(" ", 1)[0]
+STARTED_US = monotonic_us()
+
 @dataclass
 class UIState:
     """UI state management"""
     palette_visible: bool = False
     selected_component: Optional[str] = None
-    scroll_offset: int = 0
+    scroll_offset: int = 0   # First visible item
+    cursor: int = 0          # Item select_component picks
     rotation: int = 0  # 0, 90, 180, 270
     scale: float = 1.0
     history: List[Dict] = field(default_factory=list)
     component_list: List[str] = field(default_factory=list)
+    # What is currently inked in the panel, see panel_model()
+    inked: Optional[Dict] = None
+    # "gx,gy" grid cell -> history indices with a stroke box in that cell
+    index: Dict[str, List[int]] = field(default_factory=dict)
+
+@dataclass
+class Shape:
+    """A component's strokes at one scale and rotation, placed at 0, 0"""
+    strokes: List[List[Tuple[int, int]]]
+    boxes: List[List[int]]
 
 class SymbolUIController:
     def __init__(self, library_path: Path, state_file: Path):
@@ -52,9 +102,17 @@ class SymbolUIController:
         # Build component list
         if self.library and "components" in self.library:
             self.state.component_list = sorted(self.library["components"].keys())
+
+        # State from before the index existed
+        if self.state.history and not self.state.index:
+            self.rebuild_index()
+        self.loaded_us = monotonic_us()
+        self.traced = False
     
     def load_library(self) -> Dict:
         """Load component library"""
+        # (component, scale step, rotation) -> Shape, only valid for this library
+        self.shapes = OrderedDict()
         if not self.library_path.exists():
             print(f"Error: Library not found: {self.library_path}", file=sys.stderr)
             return {}
@@ -72,9 +130,12 @@ class SymbolUIController:
                     state.palette_visible = data.get("palette_visible", False)
                     state.selected_component = data.get("selected_component")
                     state.scroll_offset = data.get("scroll_offset", 0)
+                    state.cursor = data.get("cursor", state.scroll_offset)
                     state.rotation = data.get("rotation", 0)
                     state.scale = data.get("scale", 1.0)
                     state.history = data.get("history", [])
+                    state.inked = data.get("inked")
+                    state.index = data.get("index", {})
                     return state
             except Exception as e:
                 print(f"Warning: Failed to load state: {e}", file=sys.stderr)
@@ -87,9 +148,12 @@ class SymbolUIController:
             "palette_visible": self.state.palette_visible,
             "selected_component": self.state.selected_component,
             "scroll_offset": self.state.scroll_offset,
+            "cursor": self.state.cursor,
             "rotation": self.state.rotation,
             "scale": self.state.scale,
-            "history": self.state.history
+            "history": self.state.history,
+            "inked": self.state.inked,
+            "index": self.state.index
         }
         
         with open(self.state_file, 'w') as f:
@@ -97,140 +161,200 @@ class SymbolUIController:
     
     def send_lamp_commands(self, commands: List[str]):
         """Send commands to lamp via stdin"""
+        if TRACE_ID and not self.traced:
+            self.traced = True
+            commands = [f"trace {TRACE_ID} start {STARTED_US}",
+                        f"trace {TRACE_ID} loaded {self.loaded_us}",
+                        f"trace {TRACE_ID} emitted {monotonic_us()}"] + commands
         # Direct output to stdout for piping to lamp
         print("\n".join(commands))
         sys.stdout.flush()
     
     def render_text(self, text: str, x: int, y: int, scale: int = 4) -> List[str]:
-        """Generate lamp commands to render text using font glyphs"""
-        commands = []
-        
-        if "font" not in self.library:
-            return commands
-        
-        font = self.library["font"]
-        cursor_x = x
-        glyph_spacing = 25 * scale
-        
-        for char in text.upper():
-            if char == " ":
-                cursor_x += glyph_spacing
-                continue
-            
-            if char not in font:
-                continue
-            
-            glyph = font[char]
-            
-            # Scale and translate glyph commands
-            for cmd in glyph["commands"]:
-                parts = cmd.split()
-                
-                if len(parts) >= 4 and parts[0] == "pen" and parts[1] in ["down", "move"]:
-                    px = int(float(parts[2]) * scale) + cursor_x
-                    py = int(float(parts[3]) * scale) + y
-                    commands.append(f"pen {parts[1]} {px} {py}")
-                
-                elif len(parts) >= 5 and parts[0] == "pen" and parts[1] == "circle":
-                    cx = int(float(parts[2]) * scale) + cursor_x
-                    cy = int(float(parts[3]) * scale) + y
-                    r = int(float(parts[4]) * scale)
-                    commands.append(f"pen circle {cx} {cy} {r}")
-                
-                elif len(parts) >= 6 and parts[0] == "pen" and parts[1] == "line":
-                    x1 = int(float(parts[2]) * scale) + cursor_x
-                    y1 = int(float(parts[3]) * scale) + y
-                    x2 = int(float(parts[4]) * scale) + cursor_x
-                    y2 = int(float(parts[5]) * scale) + y
-                    commands.append(f"pen line {x1} {y1} {x2} {y2}")
-                
-                elif parts[0] == "pen" and parts[1] == "up":
-                    commands.append("pen up")
-            
-            cursor_x += glyph_spacing
-        
-        return commands
-    
-    def render_palette(self) -> List[str]:
-        """Render the component palette UI"""
-        commands = []
-        
-        if not self.state.palette_visible:
-            return commands
-        
-        # Draw panel background border
-        commands.append(f"pen rectangle {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}")
-        
-        # Calculate visible range
-        start_idx = self.state.scroll_offset
-        end_idx = min(start_idx + UI_VISIBLE_ITEMS, len(self.state.component_list))
-        
-        # Render component list
-        for i in range(start_idx, end_idx):
-            component = self.state.component_list[i]
-            y_pos = UI_PANEL_Y + UI_MARGIN + (i - start_idx) * UI_ITEM_HEIGHT
-            
-            # Highlight selected component
-            if component == self.state.selected_component:
-                commands.append(f"pen rectangle {UI_PANEL_X + 10} {y_pos - 5} {SCREEN_WIDTH - 10} {y_pos + 75}")
-            
-            # Render component name
-            text_cmds = self.render_text(component, UI_PANEL_X + UI_MARGIN, y_pos + 20, scale=UI_TEXT_SCALE)
-            commands.extend(text_cmds)
-        
-        # Draw scroll indicator
+        """Generate lamp commands to render text using font glyphs.
+
+        lamp lays the glyphs out itself, with the advances and kerning the
+        library build computed, see its text command.
+        """
+        return [f"text {x} {y} {scale} {text.upper()}"]
+
+    def ui_box(self, x1: int, y1: int, x2: int, y2: int) -> List[str]:
+        """Outline of a palette box"""
+        tool = "fb" if UI_OVERLAY else "pen"
+        return [f"{tool} rectangle {x1} {y1} {x2} {y2}"]
+
+    def ui_line(self, x1: int, y1: int, x2: int, y2: int) -> List[str]:
+        tool = "fb" if UI_OVERLAY else "pen"
+        return [f"{tool} line {x1} {y1} {x2} {y2}"]
+
+    def ui_clear(self, x1: int, y1: int, x2: int, y2: int) -> List[str]:
+        """Remove palette chrome inside a rect"""
+        tool = "fb" if UI_OVERLAY else "eraser"
+        return [f"{tool} clear {x1} {y1} {x2} {y2}"]
+
+    def ui_text(self, text: str, x: int, y: int) -> List[str]:
+        if UI_OVERLAY:
+            return [f"fb text {x} {y} {UI_FONT_SIZE} {text.upper()}"]
+        return self.render_text(text, x, y, scale=UI_TEXT_SCALE)
+
+    def row_y(self, row: int) -> int:
+        """Top of the text area of a visible row"""
+        return UI_PANEL_Y + UI_MARGIN + row * UI_ITEM_HEIGHT
+
+    def row_rect(self, row: int) -> Tuple[int, int, int, int]:
+        """Strip owned by a visible row, rows never overlap"""
+        y = self.row_y(row)
+        return (UI_ROW_X1, y - 8, UI_ROW_X2, y + UI_ITEM_HEIGHT - 8)
+
+    def panel_model(self) -> Dict:
+        """What the panel should show for the current state.
+
+        rows holds one [name, selected, cursor] entry per visible row (None
+        for empty rows) and indicator the scroll indicator's y range.
+        """
+        rows = []
+        for row in range(UI_VISIBLE_ITEMS):
+            i = self.state.scroll_offset + row
+            if i < len(self.state.component_list):
+                name = self.state.component_list[i]
+                rows.append([name, name == self.state.selected_component, i == self.state.cursor])
+            else:
+                rows.append(None)
+
+        indicator = None
         if len(self.state.component_list) > UI_VISIBLE_ITEMS:
             scroll_height = int((UI_VISIBLE_ITEMS / len(self.state.component_list)) * UI_PANEL_HEIGHT)
             scroll_y = int((self.state.scroll_offset / len(self.state.component_list)) * UI_PANEL_HEIGHT)
-            commands.append(f"pen rectangle {SCREEN_WIDTH - 20} {scroll_y} {SCREEN_WIDTH - 10} {scroll_y + scroll_height}")
-        
+            indicator = [scroll_y, scroll_y + scroll_height]
+
+        return {"rows": rows, "indicator": indicator}
+
+    def render_row(self, row: int, item: List) -> List[str]:
+        """Render one visible row: highlight, cursor mark and name"""
+        name, selected, cursor = item
+        y_pos = self.row_y(row)
+        commands = []
+
+        # Highlight selected component
+        if selected:
+            commands.extend(self.ui_box(UI_PANEL_X + 10, y_pos - 5, UI_ROW_X2 - 5, y_pos + 75))
+
+        # Cursor mark in the left margin
+        if cursor:
+            commands.extend(self.ui_line(UI_PANEL_X + 18, y_pos + 10, UI_PANEL_X + 18, y_pos + 60))
+
+        # Render component name
+        commands.extend(self.ui_text(name, UI_PANEL_X + UI_MARGIN, y_pos + 20))
         return commands
-    
+
+    def update_panel(self) -> List[str]:
+        """Bring the inked panel in line with the state.
+
+        Only rows whose content changed are erased and redrawn, so moving the
+        cursor or the highlight touches two or three row strips instead of
+        clearing the whole panel.
+        """
+        want = self.panel_model()
+        have = self.state.inked
+        commands = []
+
+        if have is None:
+            # Nothing (or something unknown) is inked, start from a clean panel
+            commands.extend(self.ui_clear(UI_PANEL_X, UI_PANEL_Y, SCREEN_WIDTH, SCREEN_HEIGHT))
+            commands.extend(self.ui_box(UI_PANEL_X, UI_PANEL_Y, SCREEN_WIDTH, SCREEN_HEIGHT))
+            have = {"rows": [None] * UI_VISIBLE_ITEMS, "indicator": None}
+
+        changed = []
+        for row in range(UI_VISIBLE_ITEMS):
+            old = have["rows"][row] if row < len(have["rows"]) else None
+            if old != want["rows"][row]:
+                changed.append((row, old is not None))
+
+        # Erase inked rows that changed, adjacent ones as a single strip
+        run_start = None
+        for i, (row, inked) in enumerate(changed):
+            if inked and run_start is None:
+                run_start = row
+            following = changed[i + 1] if i + 1 < len(changed) else None
+            if run_start is not None and not (following and following[0] == row + 1 and following[1]):
+                x1, y1, _, _ = self.row_rect(run_start)
+                _, _, x2, y2 = self.row_rect(row)
+                commands.extend(self.ui_clear(x1, y1, x2, y2))
+                run_start = None
+
+        for row, _ in changed:
+            if want["rows"][row] is not None:
+                commands.extend(self.render_row(row, want["rows"][row]))
+
+        if have["indicator"] != want["indicator"]:
+            if have["indicator"] is not None:
+                y1, y2 = have["indicator"]
+                commands.extend(self.ui_clear(UI_INDICATOR_X1 - 5, y1, UI_INDICATOR_X2 + 5, y2))
+            if want["indicator"] is not None:
+                y1, y2 = want["indicator"]
+                commands.extend(self.ui_box(UI_INDICATOR_X1, y1, UI_INDICATOR_X2, y2))
+
+        self.state.inked = want
+        return commands
+
+    def render_palette(self) -> List[str]:
+        """Render the component palette UI from scratch"""
+        if not self.state.palette_visible:
+            return []
+
+        self.state.inked = None
+        return self.update_panel()
+
+    def redraw_panel(self):
+        """Send the incremental panel update for a state change"""
+        if self.state.palette_visible:
+            self.send_lamp_commands(self.update_panel())
+        self.save_state()
+
     def toggle_palette(self):
         """Toggle palette visibility"""
         self.state.palette_visible = not self.state.palette_visible
-        
+
         if self.state.palette_visible:
-            commands = self.render_palette()
+            # A freshly shown panel is blank, no need to erase it first
+            self.state.inked = {"rows": [None] * UI_VISIBLE_ITEMS, "indicator": None}
+            commands = self.ui_box(UI_PANEL_X, UI_PANEL_Y, SCREEN_WIDTH, SCREEN_HEIGHT)
+            commands.extend(self.update_panel())
         else:
             # Erase palette area
-            commands = [f"eraser clear {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
-        
+            commands = self.ui_clear(UI_PANEL_X, UI_PANEL_Y, SCREEN_WIDTH, SCREEN_HEIGHT)
+            self.state.inked = None
+
         self.send_lamp_commands(commands)
         self.save_state()
-    
+
     def scroll_up(self):
-        """Scroll component list up"""
-        if self.state.scroll_offset > 0:
-            self.state.scroll_offset -= 1
-            commands = [f"eraser clear {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
-            commands.extend(self.render_palette())
-            self.send_lamp_commands(commands)
-            self.save_state()
-    
+        """Move the cursor up, paging the list when it leaves the view"""
+        if self.state.cursor > 0:
+            self.state.cursor -= 1
+            if self.state.cursor < self.state.scroll_offset:
+                self.state.scroll_offset = max(0, self.state.cursor - UI_VISIBLE_ITEMS + 1)
+            self.redraw_panel()
+
     def scroll_down(self):
-        """Scroll component list down"""
-        max_scroll = max(0, len(self.state.component_list) - UI_VISIBLE_ITEMS)
-        if self.state.scroll_offset < max_scroll:
-            self.state.scroll_offset += 1
-            commands = [f"eraser clear {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
-            commands.extend(self.render_palette())
-            self.send_lamp_commands(commands)
-            self.save_state()
-    
+        """Move the cursor down, paging the list when it leaves the view"""
+        if self.state.cursor < len(self.state.component_list) - 1:
+            self.state.cursor += 1
+            if self.state.cursor >= self.state.scroll_offset + UI_VISIBLE_ITEMS:
+                max_scroll = max(0, len(self.state.component_list) - UI_VISIBLE_ITEMS)
+                self.state.scroll_offset = min(self.state.cursor, max_scroll)
+            self.redraw_panel()
+
     def select_component(self):
-        """Select currently highlighted component"""
+        """Select the component under the cursor"""
         if not self.state.component_list:
             return
-        
-        idx = self.state.scroll_offset
+
+        idx = self.state.cursor
         if idx < len(self.state.component_list):
             self.state.selected_component = self.state.component_list[idx]
-            commands = [f"eraser clear {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
-            commands.extend(self.render_palette())
-            self.send_lamp_commands(commands)
-            self.save_state()
-    
+            self.redraw_panel()
+
     def place_component(self):
         """Place selected component at tap location (read from env vars)"""
         if not self.state.selected_component:
@@ -244,44 +368,149 @@ class SymbolUIController:
         if not component:
             return
         
-        # Transform and place component
-        commands = []
-        for cmd in component["commands"]:
-            parts = cmd.split()
-            
-            # Apply scale transforms (rotation TODO)
-            if len(parts) >= 4 and parts[0] == "pen" and parts[1] in ["down", "move"]:
-                px = int(float(parts[2]) * self.state.scale) + x
-                py = int(float(parts[3]) * self.state.scale) + y
-                commands.append(f"pen {parts[1]} {px} {py}")
-            
-            elif parts[0] == "pen" and parts[1] == "up":
-                commands.append("pen up")
-        
-        # Save to history
-        self.state.history.append({
+        entry = {
             "component": self.state.selected_component,
             "x": x,
             "y": y,
             "scale": self.state.scale,
             "rotation": self.state.rotation
-        })
-        
-        self.send_lamp_commands(commands)
+        }
+        strokes = self.component_strokes(entry)
+        entry["boxes"] = self.placed_boxes(entry)
+
+        # Save to history
+        self.state.history.append(entry)
+        self.index_entry(len(self.state.history) - 1)
+
+        self.send_lamp_commands([cmd for stroke in strokes for cmd in stroke])
         self.save_state()
     
+    def shape(self, entry: Dict) -> Shape:
+        """The placed component's strokes before translation, see Shape.
+
+        Filled lazily per (component, scale step, rotation), so placing or
+        redrawing a component again only adds its x, y to the points. The
+        transform is lamp's StrokeLibrary::placement: scale about the origin,
+        rotate about the scaled center of the component's points.
+        """
+        name = entry["component"]
+        step = round(entry["scale"] * 4)
+        rotation = entry.get("rotation", 0) % 360
+        key = (name, step, rotation)
+        shape = self.shapes.get(key)
+        if shape is not None:
+            self.shapes.move_to_end(key)
+            return shape
+
+        raw = []
+        component = self.library.get("components", {}).get(name)
+        stroke = []
+        for cmd in component["commands"] if component else []:
+            parts = cmd.split()
+            if len(parts) >= 4 and parts[0] == "pen" and parts[1] in ["down", "move"]:
+                stroke.append((float(parts[2]), float(parts[3])))
+            elif parts[0] == "pen" and parts[1] == "up" and stroke:
+                raw.append(stroke)
+                stroke = []
+        if stroke:
+            raw.append(stroke)
+
+        strokes = []
+        if raw:
+            scale = step / 4
+            rad = math.radians(rotation)
+            cs = math.cos(rad)
+            sn = math.sin(rad)
+            xs = [x for stroke in raw for x, _ in stroke]
+            ys = [y for stroke in raw for _, y in stroke]
+            cx = (min(xs) + max(xs)) / 2
+            cy = (min(ys) + max(ys)) / 2
+            c = scale * (cx - cs * cx + sn * cy)
+            f = scale * (cy - sn * cx - cs * cy)
+            strokes = [[(lround(scale * (cs * x - sn * y) + c), lround(scale * (sn * x + cs * y) + f))
+                        for x, y in stroke] for stroke in raw]
+
+        boxes = [[min(x for x, _ in stroke), min(y for _, y in stroke),
+                  max(x for x, _ in stroke), max(y for _, y in stroke)] for stroke in strokes]
+        shape = Shape(strokes, boxes)
+        self.shapes[key] = shape
+        if len(self.shapes) > SHAPE_CACHE_SIZE:
+            self.shapes.popitem(last=False)
+        return shape
+
+    def placed_boxes(self, entry: Dict) -> List[List[int]]:
+        """[x1, y1, x2, y2] around each stroke of a placed component"""
+        x = entry["x"]
+        y = entry["y"]
+        return [[x1 + x, y1 + y, x2 + x, y2 + y] for x1, y1, x2, y2 in self.shape(entry).boxes]
+
+    def component_strokes(self, entry: Dict) -> List[List[str]]:
+        """Pen commands of a placed component, one list per stroke"""
+        x = entry["x"]
+        y = entry["y"]
+        strokes = []
+        for points in self.shape(entry).strokes:
+            stroke = [f"pen down {points[0][0] + x} {points[0][1] + y}"]
+            stroke.extend(f"pen move {px + x} {py + y}" for px, py in points[1:])
+            stroke.append("pen up")
+            strokes.append(stroke)
+        return strokes
+
+    def box_cells(self, box: List[int]) -> List[str]:
+        """Keys of the index cells a box touches"""
+        x1, y1, x2, y2 = box
+        if x2 < x1 or y2 < y1:
+            return []
+        return [f"{gx},{gy}"
+                for gy in range(y1 // INDEX_CELL, y2 // INDEX_CELL + 1)
+                for gx in range(x1 // INDEX_CELL, x2 // INDEX_CELL + 1)]
+
+    def index_entry(self, i: int):
+        """Add the stroke boxes of history entry i to the index"""
+        for box in self.state.history[i].get("boxes", []):
+            for key in self.box_cells(box):
+                cell = self.state.index.setdefault(key, [])
+                if not cell or cell[-1] != i:
+                    cell.append(i)
+
+    def unindex_entry(self, i: int):
+        for box in self.state.history[i].get("boxes", []):
+            for key in self.box_cells(box):
+                cell = self.state.index.get(key)
+                if cell and i in cell:
+                    cell.remove(i)
+                    if not cell:
+                        del self.state.index[key]
+
+    def rebuild_index(self):
+        self.state.index = {}
+        for i, entry in enumerate(self.state.history):
+            if "boxes" not in entry:
+                entry["boxes"] = self.placed_boxes(entry)
+            self.index_entry(i)
+
+    def query_index(self, box: List[int]) -> List[int]:
+        """History indices with a stroke box in the cells box touches"""
+        found = set()
+        for key in self.box_cells(box):
+            found.update(self.state.index.get(key, []))
+        return sorted(found)
+
     def cancel_selection(self):
         """Cancel current selection"""
         self.state.selected_component = None
-        commands = [f"eraser clear {UI_PANEL_X} {UI_PANEL_Y} {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
-        commands.extend(self.render_palette())
-        self.send_lamp_commands(commands)
-        self.save_state()
+        self.redraw_panel()
     
     def clear_screen(self):
         """Clear entire screen"""
-        commands = [f"eraser clear 0 0 {SCREEN_WIDTH} {SCREEN_HEIGHT}"]
+        # Drop the overlay first, it would otherwise restore the strokes
+        # that were under it once the eraser has gone over them
+        commands = ["fb clear"] if UI_OVERLAY else []
+        commands.append(f"eraser clear 0 0 {SCREEN_WIDTH} {SCREEN_HEIGHT}")
         self.state.history = []
+        self.state.index = {}
+        self.state.palette_visible = False
+        self.state.inked = None
         self.send_lamp_commands(commands)
         self.save_state()
     
@@ -306,12 +535,40 @@ class SymbolUIController:
         self.save_state()
     
     def undo(self):
-        """Undo last placement"""
+        """Undo last placement.
+
+        The component's strokes are retraced with the eraser, so only the
+        ink underneath them goes, and the strokes of other components that
+        the eraser came near (found through the index) are inked again.
+        """
         if not self.state.history:
             return
-        
-        last = self.state.history.pop()
-        # TODO: Implement smart erase of last component
+
+        i = len(self.state.history) - 1
+        last = self.state.history[i]
+        self.unindex_entry(i)
+        self.state.history.pop()
+
+        commands = []
+        erased = []
+        for stroke, (x1, y1, x2, y2) in zip(self.component_strokes(last), self.placed_boxes(last)):
+            for cmd in stroke:
+                commands.append(cmd.replace("pen", "eraser", 1))
+            erased.append([x1 - ERASE_MARGIN, y1 - ERASE_MARGIN, x2 + ERASE_MARGIN, y2 + ERASE_MARGIN])
+
+        def overlaps(box):
+            return any(box[0] <= e[2] and box[2] >= e[0] and box[1] <= e[3] and box[3] >= e[1] for e in erased)
+
+        neighbours = set()
+        for box in erased:
+            neighbours.update(self.query_index(box))
+        for j in sorted(neighbours):
+            entry = self.state.history[j]
+            for stroke, box in zip(self.component_strokes(entry), entry.get("boxes", [])):
+                if overlaps(box):
+                    commands.extend(stroke)
+
+        self.send_lamp_commands(commands)
         self.save_state()
     
     def save_drawing(self):
@@ -331,7 +588,48 @@ class SymbolUIController:
         
         # Clear and replay
         self.clear_screen()
-        # TODO: Replay all components from history
+        self.state.history = history
+        self.rebuild_index()
+        self.send_lamp_commands(self.replay_commands())
+        self.save_state()
+
+    def replay_commands(self) -> List[str]:
+        """The whole history as one batched stream of pen commands.
+
+        lamp gets every stroke at once, without a settle pause between
+        components. Components are drawn in nearest neighbour order, each
+        either as stored or backwards (last stroke first), whichever starts
+        closer to where the pen lifted.
+        """
+        shapes = [self.shape(e).strokes for e in self.state.history]
+        todo = [i for i, shape in enumerate(shapes) if shape]
+        commands = ["batch stroke"]
+        px = py = 0
+        while todo:
+            best = None
+            for i in todo:
+                entry = self.state.history[i]
+                first = shapes[i][0][0]
+                last = shapes[i][-1][-1]
+                for reverse, (sx, sy) in ((False, first), (True, last)):
+                    d = (sx + entry["x"] - px) ** 2 + (sy + entry["y"] - py) ** 2
+                    if best is None or d < best[0]:
+                        best = (d, i, reverse)
+            _, i, reverse = best
+            todo.remove(i)
+
+            entry = self.state.history[i]
+            strokes = shapes[i]
+            if reverse:
+                strokes = [stroke[::-1] for stroke in reversed(strokes)]
+            for stroke in strokes:
+                for n, (sx, sy) in enumerate(stroke):
+                    px = sx + entry["x"]
+                    py = sy + entry["y"]
+                    commands.append(f"pen {'move' if n else 'down'} {px} {py}")
+                commands.append("pen up")
+        commands.append("batch default")
+        return commands
 
 def main():
     if len(sys.argv) < 2:
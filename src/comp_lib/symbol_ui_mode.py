@@ -4,6 +4,7 @@ symbol_ui_mode.py - Component Mode activation manager
 Manages transition between Normal Mode and Component Mode
 """
 
+import os
 import sys
 import subprocess
 from pathlib import Path
@@ -24,18 +25,27 @@ INDICATOR_Y1 = SCREEN_HEIGHT - 34
 INDICATOR_X2 = SCREEN_WIDTH
 INDICATOR_Y2 = SCREEN_HEIGHT
 
+# Draw the indicator as a framebuffer overlay instead of pen strokes, see
+# UI_OVERLAY in symbol_ui_controller.py
+UI_OVERLAY = os.environ.get("SYMBOL_UI_OVERLAY", "1") != "0"
+
 def is_active():
     """Check if Component Mode is active"""
     return MODE_FILE.exists()
 
 def draw_indicator():
     """Draw green corner indicator"""
-    cmd = f'echo "pen rectangle {INDICATOR_X1} {INDICATOR_Y1} {INDICATOR_X2} {INDICATOR_Y2}" | {LAMP_BIN}'
+    if UI_OVERLAY:
+        line = f"fb fill {INDICATOR_X1} {INDICATOR_Y1} {INDICATOR_X2} {INDICATOR_Y2}"
+    else:
+        line = f"pen rectangle {INDICATOR_X1} {INDICATOR_Y1} {INDICATOR_X2} {INDICATOR_Y2}"
+    cmd = f'echo "{line}" | {LAMP_BIN}'
     subprocess.run(cmd, shell=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
 def erase_indicator():
     """Erase corner indicator"""
-    cmd = f'echo "eraser clear {INDICATOR_X1} {INDICATOR_Y1} {INDICATOR_X2} {INDICATOR_Y2}" | {LAMP_BIN}'
+    tool = "fb" if UI_OVERLAY else "eraser"
+    cmd = f'echo "{tool} clear {INDICATOR_X1} {INDICATOR_Y1} {INDICATOR_X2} {INDICATOR_Y2}" | {LAMP_BIN}'
     subprocess.run(cmd, shell=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
 
 def activate():
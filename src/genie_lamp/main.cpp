@@ -2,53 +2,674 @@
 // No rmkit dependencies - uses only Linux input API
 
 #include <linux/input.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <string>
+#include <atomic>
 #include <fstream>
 #include <sstream>
-#include <map>
 #include <vector>
-#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
-#define TOUCH_DEVICE "/dev/input/event2"
+#define INPUT_DEVICE_FMT "/dev/input/event%d"
+#define MAX_INPUT_DEVICES 8
 #define DEFAULT_CONFIG "/opt/etc/genie_lamp.conf"
+#define LAMP_BINARY "/opt/bin/lamp"
+#define LAMP_SOCKET "/run/lamp.sock"
+// Where SIGUSR1 dumps the latency histograms
+#define STATS_FILE "/tmp/genie_lamp.stats"
+
+// Commands waiting for the executor, further gestures are dropped
+#define MAX_PENDING_COMMANDS 8
+
+// Events read per syscall. A full 5 finger frame is ~25 events
+#define READ_BATCH 64
+// Time a finger count stays blocked after its gesture fired
+#define GESTURE_COOLDOWN_MS 500
+
+// Multitouch slots we track, also the most fingers a gesture can use
+#define MAX_SLOTS 10
+// Zones are binned into a ZONE_GRID x ZONE_GRID grid over the screen
+#define ZONE_GRID 4
+// Gestures sharing one finger count, type and grid cell
+#define MAX_BIN_GESTURES 8
+
+// Zones are normalized, distances are in display pixels
+#define SCREEN_WIDTH 1404
+#define SCREEN_HEIGHT 1872
+// How far a finger may wander before a touch stops being a tap
+#define TAP_SLOP 30
+#define DEFAULT_SWIPE_DISTANCE 100
+// Release speed in px/ms above which half the swipe distance will do
+#define FLICK_SPEED 1.0f
+
+#define BITS_PER_LONG (sizeof(long) * 8)
+#define NBITS(x) ((((x) - 1) / BITS_PER_LONG) + 1)
+#define TEST_BIT(bit, array) ((array[(bit) / BITS_PER_LONG] >> ((bit) % BITS_PER_LONG)) & 1)
+
+enum DeviceKind {
+    DEVICE_OTHER,
+    DEVICE_TOUCH,
+    DEVICE_PEN,
+    DEVICE_BUTTONS
+};
+
+static int64_t now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Trace timestamps, lamp and the controller read the same clock
+static int64_t now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Log-linear latency histogram in microseconds: exact below 8us, then 8
+// buckets per power of two, so percentiles read at most 1/8 high. Recording
+// is two relaxed atomic adds, cheap enough to leave on, and the stats dump
+// can read it from another thread
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (32 * LATENCY_SUB_BUCKETS)
+
+class LatencyHistogram {
+private:
+    std::atomic<uint32_t> buckets[LATENCY_BUCKETS];
+    std::atomic<uint32_t> count;
+    std::atomic<int64_t> max_us;
+
+    static int bucket(int64_t us) {
+        if (us < LATENCY_SUB_BUCKETS) return us < 0 ? 0 : (int)us;
+        if (us > 0xffffffffLL) us = 0xffffffffLL;
+        int msb = 63 - __builtin_clzll(us);
+        int sub = (us >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1);
+        return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB_BUCKETS + sub;
+    }
+
+    // Largest value that lands in bucket i
+    static int64_t bucket_max(int i) {
+        if (i < LATENCY_SUB_BUCKETS) return i;
+        int shift = i / LATENCY_SUB_BUCKETS - 1;
+        int64_t lo = (int64_t)(LATENCY_SUB_BUCKETS + i % LATENCY_SUB_BUCKETS) << shift;
+        return lo + ((int64_t)1 << shift) - 1;
+    }
+
+public:
+    LatencyHistogram() : count(0), max_us(0) {
+        for (int i = 0; i < LATENCY_BUCKETS; i++) buckets[i].store(0, std::memory_order_relaxed);
+    }
+
+    void record(int64_t us) {
+        buckets[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        int64_t m = max_us.load(std::memory_order_relaxed);
+        while (us > m && !max_us.compare_exchange_weak(m, us, std::memory_order_relaxed)) {}
+    }
+
+    // p in 0..1, rounded up to its bucket's bound
+    int64_t percentile(double p) const {
+        uint32_t n = count.load(std::memory_order_relaxed);
+        int64_t m = max_us.load(std::memory_order_relaxed);
+        if (n == 0) return 0;
+        uint32_t target = (uint32_t)(p * n + 0.999999);
+        uint32_t seen = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen >= target) return bucket_max(i) < m ? bucket_max(i) : m;
+        }
+        return m;
+    }
+
+    void print(FILE* f, const char* name) const {
+        fprintf(f, "LATENCY %-24s count=%u p50_us=%lld p95_us=%lld p99_us=%lld max_us=%lld\n", name,
+                count.load(std::memory_order_relaxed), (long long)percentile(0.5), (long long)percentile(0.95),
+                (long long)percentile(0.99), (long long)max_us.load(std::memory_order_relaxed));
+    }
+};
+
+// What genie_lamp sees of a gesture's trip to the screen. Lamp has the
+// finer breakdown, including the controller's stages
+struct LatencyStats {
+    LatencyHistogram queue;    // Detected to picked up by the executor
+    LatencyHistogram spawn;    // Picked up to the shell command spawned
+    LatencyHistogram produce;  // Picked up to the producer's output captured
+    LatencyHistogram draw;     // Sent to the daemon until it acked the frame
+    LatencyHistogram total;    // Detected to acked, daemon commands only
+
+    bool write(const char* path) const {
+        FILE* f = fopen(path, "w");
+        if (!f) return false;
+        queue.print(f, "queue");
+        spawn.print(f, "spawn");
+        produce.print(f, "produce");
+        draw.print(f, "draw");
+        total.print(f, "total");
+        fclose(f);
+        return true;
+    }
+};
+
+extern char** environ;
+
+// How a configured command gets run, decided once at config load
+enum CommandMode {
+    COMMAND_SHELL,        // anything else, /bin/sh -c
+    COMMAND_LAMP_LITERAL, // echo -e "..." | /opt/bin/lamp
+    COMMAND_LAMP_PIPE     // producer | /opt/bin/lamp
+};
+
+enum GestureType {
+    GESTURE_TAP,
+    GESTURE_SWIPE,
+    GESTURE_TYPES
+};
+
+enum SwipeDirection {
+    SWIPE_NONE,
+    SWIPE_LEFT,
+    SWIPE_RIGHT,
+    SWIPE_UP,
+    SWIPE_DOWN
+};
+
+// Normalized screen rectangle, 0..1 on both axes
+struct Zone {
+    float x1, y1, x2, y2;
+
+    Zone() : x1(0), y1(0), x2(1), y2(1) {}
+
+    bool contains(float x, float y) const {
+        return x >= x1 && x <= x2 && y >= y1 && y <= y2;
+    }
+
+    float area() const {
+        return (x2 - x1) * (y2 - y1);
+    }
+};
 
 struct GestureConfig {
-    std::string gesture_type;  // "tap"
+    std::string gesture_type;  // "tap" or "swipe"
+    GestureType type;
     int fingers;
+    Zone zone;
+    SwipeDirection direction;  // Swipes only
+    int distance;              // Swipes only, pixels
+    int duration_ms;           // Taps only, hold time before firing
     std::string command;
 
-    GestureConfig() : fingers(0) {}
+    CommandMode mode;
+    std::string lamp_input;    // Lamp commands for COMMAND_LAMP_LITERAL, may use $GESTURE_X/Y
+    std::string producer;      // Left side of the pipe for COMMAND_LAMP_PIPE
+
+    GestureConfig() : type(GESTURE_TAP), fingers(0), direction(SWIPE_NONE), distance(DEFAULT_SWIPE_DISTANCE),
+                      duration_ms(0), mode(COMMAND_SHELL) {}
+};
+
+// Indices into the gesture list for one finger count, type and zone cell
+struct GestureBin {
+    uint8_t count;
+    uint8_t index[MAX_BIN_GESTURES];
+};
+
+// Gestures compiled at load time into bins by finger count, type and the
+// grid cells their zone overlaps. A lookup is a single array index and the
+// few gestures in the bin only need their exact zone checked
+class GestureTable {
+private:
+    GestureBin bins[MAX_SLOTS + 1][GESTURE_TYPES][ZONE_GRID][ZONE_GRID];
+
+    static int cell(float v) {
+        int c = (int)(v * ZONE_GRID);
+        if (c < 0) return 0;
+        if (c >= ZONE_GRID) return ZONE_GRID - 1;
+        return c;
+    }
+
+public:
+    GestureTable() {
+        memset(bins, 0, sizeof(bins));
+    }
+
+    bool add(int index, const GestureConfig& g) {
+        if (g.fingers < 1 || g.fingers > MAX_SLOTS || index > 255) return false;
+
+        // Check every cell first, a gesture goes in all of its bins or none
+        for (int cx = cell(g.zone.x1); cx <= cell(g.zone.x2); cx++) {
+            for (int cy = cell(g.zone.y1); cy <= cell(g.zone.y2); cy++) {
+                if (bins[g.fingers][g.type][cx][cy].count == MAX_BIN_GESTURES) return false;
+            }
+        }
+        for (int cx = cell(g.zone.x1); cx <= cell(g.zone.x2); cx++) {
+            for (int cy = cell(g.zone.y1); cy <= cell(g.zone.y2); cy++) {
+                GestureBin& bin = bins[g.fingers][g.type][cx][cy];
+                bin.index[bin.count++] = index;
+            }
+        }
+        return true;
+    }
+
+    const GestureBin& lookup(int fingers, GestureType type, float x, float y) const {
+        return bins[fingers][type][cell(x)][cell(y)];
+    }
+};
+
+static std::string trim(const std::string& s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t");
+    return s.substr(start, end - start + 1);
+}
+
+// Expands the escapes echo -e understands in our configs
+static std::string unescape_echo(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '\\' || i + 1 == s.size()) {
+            out += s[i];
+            continue;
+        }
+        char c = s[++i];
+        if (c == 'n') out += '\n';
+        else if (c == 't') out += '\t';
+        else out += c;
+    }
+    return out;
+}
+
+// Whether every $ in s starts $GESTURE_X or $GESTURE_Y, the only shell
+// expansions the executor does itself
+static bool only_gesture_vars(const std::string& s) {
+    for (size_t i = s.find('$'); i != std::string::npos; i = s.find('$', i + 1)) {
+        if (s.compare(i, 10, "$GESTURE_X") != 0 && s.compare(i, 10, "$GESTURE_Y") != 0) return false;
+    }
+    return true;
+}
+
+static std::string expand_gesture_vars(const std::string& s, int x, int y) {
+    std::string out;
+    size_t start = 0;
+    for (size_t i = s.find('$'); i != std::string::npos; i = s.find('$', start)) {
+        out.append(s, start, i - start);
+        out += std::to_string(s[i + 9] == 'X' ? x : y);
+        start = i + 10;
+    }
+    out.append(s, start, std::string::npos);
+    return out;
+}
+
+// Spots commands that only feed lamp so the executor can hand their input
+// to the lamp daemon instead of starting a shell pipeline
+static void compile_command(GestureConfig& g) {
+    g.mode = COMMAND_SHELL;
+    size_t bar = g.command.rfind('|');
+    if (bar == std::string::npos || trim(g.command.substr(bar + 1)) != LAMP_BINARY) return;
+
+    std::string left = trim(g.command.substr(0, bar));
+    if (left.empty()) return;
+
+    const std::string echo = "echo -e \"";
+    if (left.compare(0, echo.size(), echo) == 0 && left.size() > echo.size() && left[left.size() - 1] == '"') {
+        std::string body = left.substr(echo.size(), left.size() - echo.size() - 1);
+        if (body.find('"') == std::string::npos && only_gesture_vars(body)) {
+            g.mode = COMMAND_LAMP_LITERAL;
+            g.lamp_input = unescape_echo(body) + "\n";
+            return;
+        }
+    }
+
+    g.mode = COMMAND_LAMP_PIPE;
+    g.producer = left;
+}
+
+struct CommandJob {
+    int id;
+    const GestureConfig* gesture;
+    int x, y;  // Where the gesture started, in display pixels
+    int64_t trace_id;
+    int64_t detected_us;
 };
 
-struct TouchPoint {
+// Reaps every child that has exited. A handler rather than SIGCHLD set to
+// SIG_IGN, which spawned shells would inherit and lose $? and wait to
+static void reap_children(int) {
+    int saved = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0) {}
+    errno = saved;
+}
+
+// Runs gesture commands off the input thread. Jobs are queued by gesture
+// index: a gesture that is already waiting is not queued twice and once
+// MAX_PENDING_COMMANDS are waiting new ones are dropped, so a burst of taps
+// can't pile up minutes of drawing. Lamp input goes straight to the lamp
+// daemon socket when it is running, everything else is posix_spawn()ed
+// with the gesture position in GESTURE_X / GESTURE_Y.
+//
+// Every job carries a trace id (pid and a counter) and the stages it went
+// through, as LAMP_TRACE="<id> <stage> <t_us> ..." for spawned commands and
+// as trace lines ahead of daemon frames, see lamp's trace.cpy
+class CommandExecutor {
+private:
+    std::deque<CommandJob> pending;
+    std::mutex pending_m;
+    std::condition_variable pending_cv;
+    std::thread worker;
+    bool stopping;
+    int lamp_fd;
+    int64_t next_trace;
+    posix_spawnattr_t spawn_attr;
+
+public:
+    LatencyStats latency;
+
+    CommandExecutor() : stopping(false), lamp_fd(-1), next_trace((int64_t)getpid() << 32) {
+        // This thread has SIGUSR1 blocked, commands get a clean mask
+        sigset_t none;
+        sigemptyset(&none);
+        posix_spawnattr_init(&spawn_attr);
+        posix_spawnattr_setsigmask(&spawn_attr, &none);
+        posix_spawnattr_setflags(&spawn_attr, POSIX_SPAWN_SETSIGMASK);
+    }
+
+    // Lets the command in progress finish, anything still queued is dropped
+    ~CommandExecutor() {
+        {
+            std::unique_lock<std::mutex> lock(pending_m);
+            stopping = true;
+            pending_cv.notify_one();
+        }
+        if (worker.joinable()) worker.join();
+        if (lamp_fd >= 0) close(lamp_fd);
+        posix_spawnattr_destroy(&spawn_attr);
+    }
+
+    void start() {
+        // Nothing needs a command's exit status, reap them as they exit.
+        // exec() resets the handler, children start with SIGCHLD default
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = reap_children;
+        sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+        sigaction(SIGCHLD, &sa, NULL);
+
+        // SIGUSR1 is for the input thread, where it interrupts epoll_wait
+        sigset_t usr1, old;
+        sigemptyset(&usr1);
+        sigaddset(&usr1, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &usr1, &old);
+        worker = std::thread(&CommandExecutor::run, this);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+
+    // Called from the input thread, never blocks on the command
+    void submit(int id, const GestureConfig* g, int x, int y) {
+        std::unique_lock<std::mutex> lock(pending_m);
+        for (const auto& job : pending) {
+            if (job.id == id) {
+                printf("Coalesced repeated gesture: %s\n", g->command.c_str());
+                return;
+            }
+        }
+        if (pending.size() >= MAX_PENDING_COMMANDS) {
+            fprintf(stderr, "Warning: Command queue full, dropping: %s\n", g->command.c_str());
+            return;
+        }
+        CommandJob job;
+        job.id = id;
+        job.gesture = g;
+        job.x = x;
+        job.y = y;
+        job.trace_id = ++next_trace;
+        job.detected_us = now_us();
+        pending.push_back(job);
+        pending_cv.notify_one();
+    }
+
+private:
+    void run() {
+        while (true) {
+            CommandJob job;
+            {
+                std::unique_lock<std::mutex> lock(pending_m);
+                while (pending.empty() && !stopping) pending_cv.wait(lock);
+                if (stopping) return;
+                job = pending.front();
+                pending.pop_front();
+            }
+            int64_t dequeued_us = now_us();
+            latency.queue.record(dequeued_us - job.detected_us);
+
+            // Only this thread touches the environment
+            char buf[16];
+            snprintf(buf, sizeof(buf), "%d", job.x);
+            setenv("GESTURE_X", buf, 1);
+            snprintf(buf, sizeof(buf), "%d", job.y);
+            setenv("GESTURE_Y", buf, 1);
+            execute(job, dequeued_us);
+        }
+    }
+
+    // LAMP_TRACE for the command about to be spawned, spawned_us is only
+    // known for shell commands
+    static void trace_env(const CommandJob& job, int64_t dequeued_us, int64_t spawned_us) {
+        char buf[96];
+        int n = snprintf(buf, sizeof(buf), "%lld detect %lld dequeue %lld", (long long)job.trace_id,
+                         (long long)job.detected_us, (long long)dequeued_us);
+        if (spawned_us) snprintf(buf + n, sizeof(buf) - n, " spawn %lld", (long long)spawned_us);
+        setenv("LAMP_TRACE", buf, 1);
+    }
+
+    static void trace_line(std::string& out, int64_t id, const char* stage, int64_t t_us) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "trace %lld %s %lld\n", (long long)id, stage, (long long)t_us);
+        out += buf;
+    }
+
+    void execute(const CommandJob& job, int64_t dequeued_us) {
+        const GestureConfig& g = *job.gesture;
+        if (g.mode != COMMAND_SHELL && lamp_connect()) {
+            std::string input;
+            trace_line(input, job.trace_id, "detect", job.detected_us);
+            trace_line(input, job.trace_id, "dequeue", dequeued_us);
+            if (g.mode == COMMAND_LAMP_PIPE) {
+                trace_env(job, dequeued_us, 0);
+                if (!capture(g.producer, input)) {
+                    fprintf(stderr, "Warning: Command failed: %s\n", g.producer.c_str());
+                    return;
+                }
+                int64_t captured_us = now_us();
+                latency.produce.record(captured_us - dequeued_us);
+                trace_line(input, job.trace_id, "captured", captured_us);
+            } else {
+                input += expand_gesture_vars(g.lamp_input, job.x, job.y);
+            }
+
+            printf("Sending to lamp: %s\n", g.command.c_str());
+            int64_t sent_us = now_us();
+            trace_line(input, job.trace_id, "sent", sent_us);
+            if (!lamp_send(input)) {
+                fprintf(stderr, "Warning: Lamp daemon went away, dropped: %s\n", g.command.c_str());
+                return;
+            }
+            int64_t acked_us = now_us();
+            latency.draw.record(acked_us - sent_us);
+            latency.total.record(acked_us - job.detected_us);
+            return;
+        }
+
+        printf("Running: %s\n", g.command.c_str());
+        const char* argv[] = { "/bin/sh", "-c", g.command.c_str(), NULL };
+        int64_t spawned_us = now_us();
+        trace_env(job, dequeued_us, spawned_us);
+        pid_t pid;
+        int ret = posix_spawn(&pid, "/bin/sh", NULL, &spawn_attr, (char* const*)argv, environ);
+        if (ret != 0) {
+            fprintf(stderr, "Warning: Could not spawn command: %s\n", strerror(ret));
+            return;
+        }
+        latency.spawn.record(now_us() - dequeued_us);
+    }
+
+    // Runs cmd through the shell and collects its stdout
+    bool capture(const std::string& cmd, std::string& out) {
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) < 0) return false;
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+
+        printf("Running: %s\n", cmd.c_str());
+        const char* argv[] = { "/bin/sh", "-c", cmd.c_str(), NULL };
+        pid_t pid;
+        int ret = posix_spawn(&pid, "/bin/sh", &actions, &spawn_attr, (char* const*)argv, environ);
+        posix_spawn_file_actions_destroy(&actions);
+        close(fds[1]);
+        if (ret != 0) {
+            close(fds[0]);
+            return false;
+        }
+
+        char buf[4096];
+        while (true) {
+            ssize_t n = read(fds[0], buf, sizeof(buf));
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            out.append(buf, n);
+        }
+        close(fds[0]);
+        return true;
+    }
+
+    bool lamp_connect() {
+        if (lamp_fd >= 0) return true;
+
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0) return false;
+
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, LAMP_SOCKET, sizeof(addr.sun_path) - 1);
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return false;
+        }
+        lamp_fd = fd;
+        return true;
+    }
+
+    // One frame of the lamp daemon protocol: native uint32_t length and the
+    // commands, answered with a uint32_t once they have been drawn
+    bool lamp_send(const std::string& input) {
+        uint32_t len = input.size();
+        uint32_t executed;
+        bool ok = write_all(&len, sizeof(len)) && write_all(input.data(), len) && read_all(&executed, sizeof(executed));
+        if (!ok) {
+            close(lamp_fd);
+            lamp_fd = -1;
+        }
+        return ok;
+    }
+
+    bool write_all(const void* buf, size_t len) {
+        const char* p = (const char*)buf;
+        while (len > 0) {
+            ssize_t n = send(lamp_fd, p, len, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+    bool read_all(void* buf, size_t len) {
+        char* p = (char*)buf;
+        while (len > 0) {
+            ssize_t n = read(lamp_fd, p, len);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+};
+
+// Per slot accumulators, kept until the whole touch session ends so
+// fingers lifted early still count towards the swipe
+struct TouchSlot {
     int tracking_id;
-    int x;
-    int y;
     bool active;
+    bool used;       // Touched during the current session
+    bool fresh;      // Landed this frame, start not taken yet
+    float x, y;      // Display pixels
+    float start_x, start_y;
+    float prev_x, prev_y;
+    float vx, vy;    // Smoothed velocity, px/ms
+    int64_t last_ms;
 };
 
+// Streaming recognizer: a session runs from the first finger down to the
+// last finger up and only keeps running per slot sums, no touch history.
+// Swipes are decided on release from the mean displacement and release
+// velocity of the session's fingers, taps on release when nothing moved
+// past TAP_SLOP, and held taps (duration=) from the timerfd while the
+// fingers are still down
 class SimpleGestureDetector {
 private:
-    std::map<int, TouchPoint> touches;
+    TouchSlot slots[MAX_SLOTS];
     int current_slot;
-    TouchPoint pending_update;
-    bool has_pending;
-    std::set<int> active_ids;
+    int active_count;
+    int last_finger_count;
+    bool pen_in_range;
+    float touch_max_x, touch_max_y;
+
+    // Current session
+    int session_fingers;     // Most fingers down at once
+    int64_t fingers_since;   // When session_fingers was reached
+    int64_t hold_deadline;   // Next held tap check, 0 if none
+    bool session_moved;
+    bool session_fired;
+
     std::vector<GestureConfig> gestures;
-    std::map<int, bool> gesture_fired;      // Track if gesture with N fingers fired
-    std::map<int, int> gesture_cooldown;    // Cooldown per finger count
+    GestureTable table;
+    int64_t cooldown_until[MAX_SLOTS + 1];  // Monotonic ms per finger count, 0 if none
+    CommandExecutor executor;
 
 public:
-    SimpleGestureDetector() : current_slot(0), has_pending(false) {
-        pending_update.tracking_id = -1;
-        pending_update.x = 0;
-        pending_update.y = 0;
-        pending_update.active = false;
+    // Touch axis defaults are the rM2 digitizer's, see set_touch_range()
+    SimpleGestureDetector() : current_slot(0), active_count(0), last_finger_count(0), pen_in_range(false),
+                              touch_max_x(1403), touch_max_y(1871), session_fingers(0), fingers_since(0),
+                              hold_deadline(0), session_moved(false), session_fired(false) {
+        memset(slots, 0, sizeof(slots));
+        memset(cooldown_until, 0, sizeof(cooldown_until));
+    }
+
+    void set_touch_range(int max_x, int max_y) {
+        if (max_x > 0) touch_max_x = max_x;
+        if (max_y > 0) touch_max_y = max_y;
     }
 
     void load_config(const char* config_file) {
@@ -60,18 +681,14 @@ public:
 
         GestureConfig current;
         std::string line;
-        int gesture_count = 0;
 
         while (std::getline(file, line)) {
             // Trim whitespace
             size_t start = line.find_first_not_of(" \t\r\n");
             if (start == std::string::npos) {
                 // Empty line - end of gesture definition
-                if (!current.gesture_type.empty() && !current.command.empty()) {
-                    gestures.push_back(current);
-                    gesture_count++;
-                    current = GestureConfig();
-                }
+                add_gesture(current);
+                current = GestureConfig();
                 continue;
             }
 
@@ -95,114 +712,439 @@ public:
                 current.gesture_type = value;
             } else if (key == "fingers") {
                 current.fingers = atoi(value.c_str());
+            } else if (key == "zone") {
+                Zone z;
+                if (sscanf(value.c_str(), "%f %f %f %f", &z.x1, &z.y1, &z.x2, &z.y2) == 4) {
+                    current.zone = z;
+                } else {
+                    fprintf(stderr, "Warning: Zone must be 4 numbers: %s\n", value.c_str());
+                }
+            } else if (key == "direction") {
+                if (value == "left") current.direction = SWIPE_LEFT;
+                else if (value == "right") current.direction = SWIPE_RIGHT;
+                else if (value == "up") current.direction = SWIPE_UP;
+                else if (value == "down") current.direction = SWIPE_DOWN;
+                else fprintf(stderr, "Warning: Unknown swipe direction: %s\n", value.c_str());
+            } else if (key == "distance") {
+                current.distance = atoi(value.c_str());
+            } else if (key == "duration") {
+                current.duration_ms = (int)(atof(value.c_str()) * 1000);
             } else if (key == "command") {
                 current.command = value;
             }
         }
 
         // Don't forget last gesture
-        if (!current.gesture_type.empty() && !current.command.empty()) {
-            gestures.push_back(current);
-            gesture_count++;
-        }
+        add_gesture(current);
 
         file.close();
-        printf("Loaded %d gesture(s) from config\n", gesture_count);
+        printf("Loaded %d gesture(s) from config\n", (int)gestures.size());
+    }
+
+    // Pen proximity, touch gestures are ignored while the pen is in range
+    void process_pen_event(const struct input_event& ev) {
+        if (ev.type == EV_KEY && (ev.code == BTN_TOOL_PEN || ev.code == BTN_TOOL_RUBBER)) {
+            pen_in_range = ev.value != 0;
+        }
     }
 
     void process_event(const struct input_event& ev) {
         if (ev.type == EV_ABS) {
-            switch (ev.code) {
-                case ABS_MT_SLOT:
-                    current_slot = ev.value;
-                    break;
+            if (ev.code == ABS_MT_SLOT) {
+                current_slot = ev.value;
+                return;
+            }
+            if (current_slot < 0 || current_slot >= MAX_SLOTS) return;
 
+            TouchSlot& slot = slots[current_slot];
+            switch (ev.code) {
                 case ABS_MT_TRACKING_ID:
                     if (ev.value == -1) {
                         // Touch lifted
-                        touches.erase(current_slot);
-                        active_ids.erase(current_slot);
-                    } else {
+                        if (slot.active) active_count--;
+                        slot.active = false;
+                    } else if (!slot.active) {
                         // New touch
-                        pending_update.tracking_id = ev.value;
-                        pending_update.active = true;
-                        has_pending = true;
-                        active_ids.insert(current_slot);
+                        if (active_count == 0) begin_session();
+                        active_count++;
+                        slot.active = true;
+                        slot.used = true;
+                        slot.fresh = true;
+                        slot.tracking_id = ev.value;
                     }
                     break;
 
                 case ABS_MT_POSITION_X:
-                    pending_update.x = ev.value;
-                    has_pending = true;
+                    slot.x = ev.value * SCREEN_WIDTH / touch_max_x;
                     break;
 
                 case ABS_MT_POSITION_Y:
-                    pending_update.y = ev.value;
-                    has_pending = true;
+                    // The rM2 digitizer's y axis runs bottom to top
+                    slot.y = (1.0f - ev.value / touch_max_y) * SCREEN_HEIGHT;
                     break;
             }
         } else if (ev.type == EV_SYN && ev.code == SYN_REPORT) {
-            // End of event frame
-            if (has_pending && pending_update.active) {
-                touches[current_slot] = pending_update;
-                pending_update.active = false;
-                has_pending = false;
+            update_slots(now_ms());
+
+            if (active_count != last_finger_count) {
+                last_finger_count = active_count;
+                on_finger_count();
             }
+        }
+    }
 
-            // Check gestures
-            detect_gestures();
+    // Earliest pending cooldown expiry or held tap check, 0 if none
+    int64_t next_deadline() const {
+        int64_t deadline = hold_deadline;
+        for (int i = 0; i <= MAX_SLOTS; i++) {
+            if (cooldown_until[i] && (deadline == 0 || cooldown_until[i] < deadline)) {
+                deadline = cooldown_until[i];
+            }
         }
+        return deadline;
     }
 
-    void detect_gestures() {
-        int finger_count = active_ids.size();
+    // Called from the timerfd once a deadline has passed
+    void on_timer(int64_t now) {
+        for (int i = 0; i <= MAX_SLOTS; i++) {
+            if (cooldown_until[i] && cooldown_until[i] <= now) cooldown_until[i] = 0;
+        }
 
-        // Update cooldowns
-        for (auto& pair : gesture_cooldown) {
-            if (pair.second > 0) pair.second--;
+        if (hold_deadline && hold_deadline <= now) {
+            hold_deadline = 0;
+            if (active_count == session_fingers && !session_moved && !session_fired) {
+                fire_taps(now - fingers_since, false);
+                schedule_hold(now);
+            }
+        }
+    }
+
+    void start() {
+        executor.start();
+    }
+
+    int get_gesture_count() const {
+        return gestures.size();
+    }
+
+    bool write_stats(const char* path) const {
+        return executor.latency.write(path);
+    }
+
+private:
+    void add_gesture(GestureConfig& g) {
+        if (g.gesture_type.empty() || g.command.empty()) return;
+
+        if (g.gesture_type == "tap") {
+            g.type = GESTURE_TAP;
+        } else if (g.gesture_type == "swipe") {
+            g.type = GESTURE_SWIPE;
+            if (g.direction == SWIPE_NONE) {
+                fprintf(stderr, "Warning: Swipe without direction, skipping: %s\n", g.command.c_str());
+                return;
+            }
+        } else {
+            fprintf(stderr, "Warning: Unknown gesture type: %s\n", g.gesture_type.c_str());
+            return;
+        }
+
+        compile_command(g);
+        if (!table.add(gestures.size(), g)) {
+            fprintf(stderr, "Warning: Too many gestures for %d finger(s), skipping: %s\n", g.fingers, g.command.c_str());
+            return;
         }
+        gestures.push_back(g);
+    }
 
-        // Reset gesture_fired when fingers are lifted
-        if (finger_count == 0) {
-            gesture_fired.clear();
+    void begin_session() {
+        for (int i = 0; i < MAX_SLOTS; i++) {
+            slots[i].used = false;
         }
+        session_fingers = 0;
+        hold_deadline = 0;
+        session_moved = false;
+        session_fired = false;
+    }
 
-        // Check each configured gesture
-        for (const auto& g : gestures) {
-            if (g.gesture_type == "tap" && g.fingers == finger_count) {
-                // Check cooldown
-                if (gesture_cooldown[finger_count] > 0) continue;
+    // Takes start points for new touches and folds this frame's motion into
+    // the velocity and slop accumulators
+    void update_slots(int64_t now) {
+        for (int i = 0; i < MAX_SLOTS; i++) {
+            TouchSlot& s = slots[i];
+            if (!s.active) continue;
 
-                // Check if not already fired
-                if (gesture_fired[finger_count]) continue;
+            if (s.fresh) {
+                s.fresh = false;
+                s.start_x = s.prev_x = s.x;
+                s.start_y = s.prev_y = s.y;
+                s.vx = s.vy = 0;
+                s.last_ms = now;
+                continue;
+            }
 
-                // Fire the gesture
-                printf("%d-finger tap detected!\n", finger_count);
-                run_command(g.command);
-                gesture_fired[finger_count] = true;
-                gesture_cooldown[finger_count] = 30; // Cooldown frames
+            int64_t dt = now - s.last_ms;
+            if (dt > 0) {
+                s.vx = 0.5f * s.vx + 0.5f * (s.x - s.prev_x) / dt;
+                s.vy = 0.5f * s.vy + 0.5f * (s.y - s.prev_y) / dt;
+                s.prev_x = s.x;
+                s.prev_y = s.y;
+                s.last_ms = now;
             }
+
+            float dx = s.x - s.start_x;
+            float dy = s.y - s.start_y;
+            if (dx * dx + dy * dy > TAP_SLOP * TAP_SLOP) session_moved = true;
         }
     }
 
-    void run_command(const std::string& cmd) {
-        std::string command = cmd + " &";
-        printf("Running: %s\n", command.c_str());
+    void on_finger_count() {
+        int64_t now = now_ms();
+        if (active_count > session_fingers) {
+            // More fingers joined, the gesture is now a bigger one
+            session_fingers = active_count;
+            fingers_since = now;
+            schedule_hold(now);
+        } else if (active_count == 0) {
+            end_session();
+        }
+    }
 
-        int ret = system(command.c_str());
-        if (ret != 0) {
-            fprintf(stderr, "Warning: Command returned %d\n", ret);
+    void end_session() {
+        hold_deadline = 0;
+        if (session_fired || session_fingers == 0) return;
+
+        if (!fire_swipes() && !session_moved) {
+            fire_taps(now_ms() - fingers_since, true);
         }
+    }
+
+    // Arms hold_deadline for the shortest held tap that hasn't come due yet
+    void schedule_hold(int64_t now) {
+        hold_deadline = 0;
+        if (session_fingers > MAX_SLOTS) return;
 
-        // Small delay to let gesture reset
-        usleep(50000);
+        float x, y;
+        start_centroid(x, y);
+        int64_t held = now - fingers_since;
+        const GestureBin& bin = table.lookup(session_fingers, GESTURE_TAP, x / SCREEN_WIDTH, y / SCREEN_HEIGHT);
+        for (int i = 0; i < bin.count; i++) {
+            const GestureConfig& g = gestures[bin.index[i]];
+            if (g.duration_ms <= held) continue;
+            int64_t due = fingers_since + g.duration_ms;
+            if (hold_deadline == 0 || due < hold_deadline) hold_deadline = due;
+        }
     }
 
-    int get_gesture_count() const {
-        return gestures.size();
+    bool can_fire(int fingers) const {
+        return !pen_in_range && fingers >= 1 && fingers <= MAX_SLOTS && !cooldown_until[fingers];
     }
+
+    void fired(int index, const GestureConfig& g, float x, float y) {
+        executor.submit(index, &g, (int)x, (int)y);
+        session_fired = true;
+        cooldown_until[g.fingers] = now_ms() + GESTURE_COOLDOWN_MS;
+    }
+
+    // Of the gestures that match, only the one with the smallest zone fires,
+    // the first configured on a tie, so a zoneless gesture is the fallback
+    // for wherever no zoned one applies. Bins list gestures in config order
+    bool more_specific(const GestureConfig& g, int best) const {
+        return best < 0 || g.zone.area() < gestures[best].zone.area();
+    }
+
+    // Held taps fire from the timer once their duration has passed, plain
+    // taps (duration=0) on release
+    void fire_taps(int64_t held, bool released) {
+        if (!can_fire(session_fingers)) return;
+
+        float x, y;
+        start_centroid(x, y);
+        int best = -1;
+        const GestureBin& bin = table.lookup(session_fingers, GESTURE_TAP, x / SCREEN_WIDTH, y / SCREEN_HEIGHT);
+        for (int i = 0; i < bin.count; i++) {
+            const GestureConfig& g = gestures[bin.index[i]];
+            if (!g.zone.contains(x / SCREEN_WIDTH, y / SCREEN_HEIGHT)) continue;
+            if (released ? g.duration_ms != 0 : (g.duration_ms == 0 || g.duration_ms > held)) continue;
+            if (more_specific(g, best)) best = bin.index[i];
+        }
+        if (best < 0) return;
+
+        printf("%d-finger tap detected!\n", session_fingers);
+        fired(best, gestures[best], x, y);
+    }
+
+    bool fire_swipes() {
+        if (!can_fire(session_fingers)) return false;
+
+        // Mean displacement and release velocity over the session's fingers
+        float dx = 0, dy = 0, vx = 0, vy = 0;
+        int n = 0;
+        for (int i = 0; i < MAX_SLOTS; i++) {
+            const TouchSlot& s = slots[i];
+            if (!s.used) continue;
+            dx += s.x - s.start_x;
+            dy += s.y - s.start_y;
+            vx += s.vx;
+            vy += s.vy;
+            n++;
+        }
+        if (n == 0) return false;
+        dx /= n;
+        dy /= n;
+        vx /= n;
+        vy /= n;
+
+        SwipeDirection dir;
+        float travel, speed;
+        if (fabsf(dx) >= fabsf(dy)) {
+            dir = dx < 0 ? SWIPE_LEFT : SWIPE_RIGHT;
+            travel = fabsf(dx);
+            speed = fabsf(vx);
+        } else {
+            dir = dy < 0 ? SWIPE_UP : SWIPE_DOWN;
+            travel = fabsf(dy);
+            speed = fabsf(vy);
+        }
+
+        float x, y;
+        start_centroid(x, y);
+        int best = -1;
+        const GestureBin& bin = table.lookup(session_fingers, GESTURE_SWIPE, x / SCREEN_WIDTH, y / SCREEN_HEIGHT);
+        for (int i = 0; i < bin.count; i++) {
+            const GestureConfig& g = gestures[bin.index[i]];
+            if (g.direction != dir || !g.zone.contains(x / SCREEN_WIDTH, y / SCREEN_HEIGHT)) continue;
+            if (travel < g.distance && (speed < FLICK_SPEED || travel < g.distance / 2)) continue;
+            if (more_specific(g, best)) best = bin.index[i];
+        }
+        if (best < 0) return false;
+
+        printf("%d-finger swipe detected!\n", session_fingers);
+        fired(best, gestures[best], x, y);
+        return true;
+    }
+
+    // Mean start position of the session's touches in display pixels
+    void start_centroid(float& x, float& y) const {
+        float sx = 0, sy = 0;
+        int n = 0;
+        for (int i = 0; i < MAX_SLOTS; i++) {
+            if (!slots[i].used) continue;
+            sx += slots[i].start_x;
+            sy += slots[i].start_y;
+            n++;
+        }
+        x = n ? sx / n : 0;
+        y = n ? sy / n : 0;
+    }
+};
+
+struct InputDevice {
+    int fd;
+    DeviceKind kind;
+    char path[32];
 };
 
+static DeviceKind classify_device(int fd) {
+    unsigned long ev_bits[NBITS(EV_MAX + 1)];
+    unsigned long abs_bits[NBITS(ABS_MAX + 1)];
+    unsigned long key_bits[NBITS(KEY_MAX + 1)];
+    memset(ev_bits, 0, sizeof(ev_bits));
+    memset(abs_bits, 0, sizeof(abs_bits));
+    memset(key_bits, 0, sizeof(key_bits));
+    ioctl(fd, EVIOCGBIT(0, sizeof(ev_bits)), ev_bits);
+    ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits);
+    ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(key_bits)), key_bits);
+
+    if (TEST_BIT(BTN_TOOL_PEN, key_bits)) return DEVICE_PEN;
+    if (TEST_BIT(ABS_MT_POSITION_X, abs_bits)) return DEVICE_TOUCH;
+    // Hardware keys (power, the rM1 page buttons)
+    if (TEST_BIT(EV_KEY, ev_bits)) return DEVICE_BUTTONS;
+    return DEVICE_OTHER;
+}
+
+static const char* device_kind_name(DeviceKind kind) {
+    switch (kind) {
+    case DEVICE_TOUCH: return "Touch";
+    case DEVICE_PEN: return "Pen";
+    case DEVICE_BUTTONS: return "Buttons";
+    default: return "Other";
+    }
+}
+
+// Opens every touch, pen and button event device and adds it to the epoll set
+static std::vector<InputDevice> open_devices(int epfd) {
+    std::vector<InputDevice> devices;
+    for (int i = 0; i < MAX_INPUT_DEVICES; i++) {
+        InputDevice dev;
+        snprintf(dev.path, sizeof(dev.path), INPUT_DEVICE_FMT, i);
+        dev.fd = open(dev.path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (dev.fd < 0) continue;
+
+        dev.kind = classify_device(dev.fd);
+        if (dev.kind == DEVICE_OTHER) {
+            close(dev.fd);
+            continue;
+        }
+        devices.push_back(dev);
+    }
+
+    // Register after the vector is final so the index stays valid
+    for (size_t i = 0; i < devices.size(); i++) {
+        struct epoll_event ee;
+        memset(&ee, 0, sizeof(ee));
+        ee.events = EPOLLIN;
+        ee.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, devices[i].fd, &ee);
+        printf("%s device: %s\n", device_kind_name(devices[i].kind), devices[i].path);
+    }
+    return devices;
+}
+
+// Drains a device, returns false once it has gone away
+static bool read_device(const InputDevice& dev, SimpleGestureDetector& detector) {
+    struct input_event evs[READ_BATCH];
+
+    while (true) {
+        ssize_t n = read(dev.fd, evs, sizeof(evs));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN) return true;
+            perror("Error reading from input device");
+            return false;
+        }
+        if (n == 0) return false;
+
+        int count = n / sizeof(struct input_event);
+        for (int i = 0; i < count; i++) {
+            if (dev.kind == DEVICE_TOUCH) {
+                detector.process_event(evs[i]);
+            } else if (dev.kind == DEVICE_PEN) {
+                detector.process_pen_event(evs[i]);
+            }
+            // Button events are drained, no gesture binds them yet
+        }
+        if (n < (ssize_t)sizeof(evs)) return true;
+    }
+}
+
+// Arms the timerfd for the detector's next deadline, or disarms it
+static void arm_timer(int tfd, int64_t deadline) {
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (deadline > 0) {
+        its.it_value.tv_sec = deadline / 1000;
+        its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+    }
+    timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+// Set by SIGUSR1, the main loop writes STATS_FILE when it sees it
+static volatile sig_atomic_t stats_requested = 0;
+
+static void request_stats(int) {
+    stats_requested = 1;
+}
+
 int main(int argc, char** argv) {
     const char* config_file = DEFAULT_CONFIG;
 
@@ -213,7 +1155,6 @@ int main(int argc, char** argv) {
 
     printf("Starting genie_lamp - standalone gesture detector\n");
     printf("Config file: %s\n", config_file);
-    printf("Touch device: %s\n", TOUCH_DEVICE);
 
     SimpleGestureDetector detector;
     detector.load_config(config_file);
@@ -224,30 +1165,93 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    int fd = open(TOUCH_DEVICE, O_RDONLY);
-    if (fd < 0) {
-        perror("Failed to open touch device");
-        fprintf(stderr, "Make sure %s exists and is readable\n", TOUCH_DEVICE);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epfd < 0 || tfd < 0) {
+        perror("Failed to set up event loop");
+        return 1;
+    }
+
+    std::vector<InputDevice> devices = open_devices(epfd);
+    bool have_touch = false;
+    for (const auto& dev : devices) {
+        if (dev.kind != DEVICE_TOUCH) continue;
+        have_touch = true;
+
+        struct input_absinfo ax, ay;
+        if (ioctl(dev.fd, EVIOCGABS(ABS_MT_POSITION_X), &ax) == 0 && ioctl(dev.fd, EVIOCGABS(ABS_MT_POSITION_Y), &ay) == 0) {
+            detector.set_touch_range(ax.maximum, ay.maximum);
+        }
+    }
+    if (!have_touch) {
+        fprintf(stderr, "Failed to find a touch device under /dev/input\n");
         return 1;
     }
 
-    printf("Successfully opened touch device\n");
+    // The timer is tagged past the end of the device indices
+    struct epoll_event ee;
+    memset(&ee, 0, sizeof(ee));
+    ee.events = EPOLLIN;
+    ee.data.u32 = devices.size();
+    epoll_ctl(epfd, EPOLL_CTL_ADD, tfd, &ee);
+
+    // No SA_RESTART, the signal has to interrupt epoll_wait
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stats;
+    sigaction(SIGUSR1, &sa, NULL);
+
+    detector.start();
     printf("Waiting for gestures...\n");
 
-    struct input_event ev;
+    struct epoll_event ready[MAX_INPUT_DEVICES + 1];
+    int64_t armed = 0;
+    bool running = true;
 
-    while (true) {
-        ssize_t n = read(fd, &ev, sizeof(ev));
-        if (n != sizeof(ev)) {
-            if (n < 0) {
-                perror("Error reading from touch device");
+    while (running) {
+        int n = epoll_wait(epfd, ready, MAX_INPUT_DEVICES + 1, -1);
+        if (stats_requested) {
+            stats_requested = 0;
+            if (detector.write_stats(STATS_FILE)) {
+                printf("Wrote latency stats to %s\n", STATS_FILE);
+            } else {
+                perror("Failed to write " STATS_FILE);
             }
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             break;
         }
 
-        detector.process_event(ev);
+        for (int i = 0; i < n; i++) {
+            uint32_t idx = ready[i].data.u32;
+            if (idx == devices.size()) {
+                uint64_t expirations;
+                if (read(tfd, &expirations, sizeof(expirations)) > 0) {
+                    armed = 0;
+                    detector.on_timer(now_ms());
+                }
+            } else if (!read_device(devices[idx], detector)) {
+                if (devices[idx].kind == DEVICE_TOUCH) {
+                    running = false;
+                    break;
+                }
+                epoll_ctl(epfd, EPOLL_CTL_DEL, devices[idx].fd, NULL);
+            }
+        }
+
+        int64_t deadline = detector.next_deadline();
+        if (deadline != armed) {
+            arm_timer(tfd, deadline);
+            armed = deadline;
+        }
     }
 
-    close(fd);
+    for (const auto& dev : devices) {
+        close(dev.fd);
+    }
+    close(tfd);
+    close(epfd);
     return 0;
 }
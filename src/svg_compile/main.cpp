@@ -0,0 +1,1546 @@
+// Native SVG to stroke compiler for the symbol library
+// Port of svg_to_lamp_smartv2.py + build_component_library.py, no Python or
+// svgpathtools needed so it also runs on the device
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SCREEN_WIDTH 1404
+#define SCREEN_HEIGHT 1872
+// Auto-scaled symbols keep this far from the screen edges
+#define AUTO_MARGIN 50
+#define MAX_AUTO_SCALE 30
+
+// Curve flattening, mirrors svg_to_lamp_smartv2.py and lamp/flatten.cpy
+#define FLATTEN_TOLERANCE 0.5
+#define FLATTEN_MAX_SEGMENTS 512
+
+// Collinearity tolerances the library builder uses
+#define COMPONENT_TOLERANCE 1.0
+#define GLYPH_TOLERANCE 1.5
+
+// Binary library layout, shared with lamp/library.cpy
+#define LIBRARY_MAGIC "LMPL"
+#define LIBRARY_VERSION 1
+#define LIBRARY_NAME_LEN 24
+#define LIBRARY_HEADER_SIZE 16
+#define LIBRARY_ENTRY_SIZE 40
+#define KIND_COMPONENT 0
+#define KIND_GLYPH 1
+#define KIND_METRICS 2
+// Glyphs are profiled in this many horizontal bands for kerning
+#define KERN_BANDS 8
+
+// Stroke ordering: ends closer than this (display px) are one polyline, and
+// 2-opt gives up after this many passes over a component
+#define JOIN_TOLERANCE 2
+#define MAX_2OPT_PASSES 50
+
+// Joined strokes are simplified to within this many display px, and the
+// simplifier window, both as in lamp/simplify.cpy
+#define SIMPLIFY_TOLERANCE 0.5
+#define SIMPLIFY_WINDOW 64
+
+// Part of every cache key, bump it whenever the output for an unchanged SVG
+// would change
+#define CACHE_VERSION "svg_compile 2"
+
+struct Point {
+    double x, y;
+};
+
+static inline Point lerp(Point a, Point b, double t) {
+    return Point{a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t};
+}
+
+// ---------------------------------------------------------------------------
+// Path segments
+
+enum SegmentKind {
+    SEG_LINE,
+    SEG_QUAD,
+    SEG_CUBIC,
+    SEG_ARC
+};
+
+struct Segment {
+    SegmentKind kind;
+    // Bezier control points, p[0] and the last one are the ends
+    Point p[4];
+
+    // Arcs, parameterized like svgpathtools.Arc
+    Point start, end;
+    double rx, ry, phi;
+    Point center;
+    double theta, delta;  // degrees
+
+    Point point(double t) const {
+        double s = 1 - t;
+        switch (kind) {
+        case SEG_LINE:
+            return lerp(p[0], p[1], t);
+        case SEG_QUAD:
+            return Point{s * s * p[0].x + 2 * s * t * p[1].x + t * t * p[2].x,
+                         s * s * p[0].y + 2 * s * t * p[1].y + t * t * p[2].y};
+        case SEG_CUBIC:
+            return Point{s * s * s * p[0].x + 3 * s * s * t * p[1].x + 3 * s * t * t * p[2].x + t * t * t * p[3].x,
+                         s * s * s * p[0].y + 3 * s * s * t * p[1].y + 3 * s * t * t * p[2].y + t * t * t * p[3].y};
+        default:
+            break;
+        }
+
+        if (t == 0) return start;
+        if (t == 1) return end;
+        double angle = (theta + t * delta) * M_PI / 180;
+        double c = cos(phi), sn = sin(phi);
+        return Point{rx * c * cos(angle) - ry * sn * sin(angle) + center.x,
+                     rx * sn * cos(angle) + ry * c * sin(angle) + center.y};
+    }
+};
+
+static double clampd(double v, double lo, double hi) {
+    return std::max(lo, std::min(hi, v));
+}
+
+// Endpoint to center conversion (SVG implementation notes F.6.5), radii
+// that are too small are scaled up until the arc fits
+static bool make_arc(Segment& seg, Point start, double rx, double ry, double rotation,
+                     bool large_arc, bool sweep, Point end) {
+    if (start.x == end.x && start.y == end.y)
+        return false;
+
+    seg.kind = SEG_ARC;
+    seg.start = start;
+    seg.end = end;
+    seg.phi = rotation * M_PI / 180;
+    rx = fabs(rx);
+    ry = fabs(ry);
+
+    double c = cos(seg.phi), s = sin(seg.phi);
+    double dx = (start.x - end.x) / 2, dy = (start.y - end.y) / 2;
+    double x1p = c * dx + s * dy;
+    double y1p = -s * dx + c * dy;
+
+    double check = (x1p * x1p) / (rx * rx) + (y1p * y1p) / (ry * ry);
+    if (check > 1) {
+        rx *= sqrt(check);
+        ry *= sqrt(check);
+    }
+    seg.rx = rx;
+    seg.ry = ry;
+
+    double tmp = rx * rx * y1p * y1p + ry * ry * x1p * x1p;
+    double radicand = (rx * rx * ry * ry - tmp) / tmp;
+    double radical = radicand > 0 ? sqrt(radicand) : 0;
+    if (large_arc == sweep)
+        radical = -radical;
+    double cxp = radical * rx * y1p / ry;
+    double cyp = -radical * ry * x1p / rx;
+    seg.center = Point{c * cxp - s * cyp + (start.x + end.x) / 2,
+                       s * cxp + c * cyp + (start.y + end.y) / 2};
+
+    Point u1{clampd((x1p - cxp) / rx, -1, 1), clampd((y1p - cyp) / ry, -1, 1)};
+    Point u2{clampd((-x1p - cxp) / rx, -1, 1), clampd((-y1p - cyp) / ry, -1, 1)};
+
+    if (u1.y > 0)
+        seg.theta = acos(u1.x) * 180 / M_PI;
+    else if (u1.y < 0)
+        seg.theta = -acos(u1.x) * 180 / M_PI;
+    else
+        seg.theta = u1.x > 0 ? 0 : 180;
+
+    double det = u1.x * u2.y - u1.y * u2.x;
+    double dot = clampd(u1.x * u2.x + u1.y * u2.y, -1, 1);
+    if (det > 0)
+        seg.delta = acos(dot) * 180 / M_PI;
+    else if (det < 0)
+        seg.delta = -acos(dot) * 180 / M_PI;
+    else
+        seg.delta = dot > 0 ? 0 : 180;
+
+    if (!sweep && seg.delta >= 0)
+        seg.delta -= 360;
+    else if (sweep && seg.delta <= 0)
+        seg.delta += 360;
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Path data, tokenized like svgpathtools: command letters and numbers,
+// anything else in between is ignored
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Length of the number at s[i] (regex [-+]?[0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?)
+// or 0 if there is none
+static size_t match_float(const std::string& s, size_t i, bool sign, bool exponent) {
+    size_t j = i;
+    if (sign && j < s.size() && (s[j] == '-' || s[j] == '+'))
+        j++;
+    size_t k = j;
+    while (k < s.size() && is_digit(s[k]))
+        k++;
+    size_t end;
+    if (k < s.size() && s[k] == '.' && k + 1 < s.size() && is_digit(s[k + 1])) {
+        end = k + 1;
+        while (end < s.size() && is_digit(s[end]))
+            end++;
+    } else if (k > j) {
+        end = k;
+    } else {
+        return 0;
+    }
+
+    if (exponent && end < s.size() && (s[end] == 'e' || s[end] == 'E')) {
+        size_t e = end + 1;
+        if (e < s.size() && (s[e] == '-' || s[e] == '+'))
+            e++;
+        if (e < s.size() && is_digit(s[e])) {
+            while (e < s.size() && is_digit(s[e]))
+                e++;
+            end = e;
+        }
+    }
+    return end - i;
+}
+
+struct Token {
+    char command;  // 0 for numbers
+    double value;
+};
+
+static std::vector<Token> tokenize_path(const std::string& d) {
+    static const char* COMMANDS = "MmZzLlHhVvCcSsQqTtAa";
+    std::vector<Token> tokens;
+    size_t i = 0;
+    while (i < d.size()) {
+        if (strchr(COMMANDS, d[i]) != NULL && d[i] != 0) {
+            tokens.push_back(Token{d[i], 0});
+            i++;
+            continue;
+        }
+        size_t n = match_float(d, i, true, true);
+        if (n > 0) {
+            tokens.push_back(Token{0, strtod(d.substr(i, n).c_str(), NULL)});
+            i += n;
+        } else {
+            i++;
+        }
+    }
+    return tokens;
+}
+
+// svgpathtools.parse_path: every subpath's segments in one list, Z closes
+// with a line unless the pen is already back at the start
+static bool parse_path(const std::string& d, std::vector<Segment>& segments) {
+    std::vector<Token> tokens = tokenize_path(d);
+    size_t i = 0;
+    char command = 0;
+    Point current{0, 0}, start{0, 0};
+    Point last_cubic{0, 0}, last_quad{0, 0};
+    char last_kind = 0;  // 'C' or 'Q' when the previous segment was one of them
+
+    auto number = [&](double& v) {
+        if (i >= tokens.size() || tokens[i].command)
+            return false;
+        v = tokens[i++].value;
+        return true;
+    };
+    auto line = [&](Point to) {
+        Segment seg;
+        seg.kind = SEG_LINE;
+        seg.p[0] = current;
+        seg.p[1] = to;
+        segments.push_back(seg);
+        current = to;
+    };
+
+    while (i < tokens.size()) {
+        if (tokens[i].command) {
+            command = tokens[i++].command;
+        } else if (command == 0) {
+            return false;
+        }
+        // Implicit repeats of a moveto are linetos
+        else if (command == 'M') {
+            command = 'L';
+        } else if (command == 'm') {
+            command = 'l';
+        }
+
+        bool absolute = command >= 'A' && command <= 'Z';
+        Point rel = absolute ? Point{0, 0} : current;
+        char kind = 0;
+        double a[7];
+
+        switch (command) {
+        case 'M': case 'm':
+            if (!number(a[0]) || !number(a[1])) return false;
+            current = start = Point{a[0] + rel.x, a[1] + rel.y};
+            break;
+
+        case 'Z': case 'z':
+            if (current.x != start.x || current.y != start.y)
+                line(start);
+            current = start;
+            command = 0;
+            break;
+
+        case 'L': case 'l':
+            if (!number(a[0]) || !number(a[1])) return false;
+            line(Point{a[0] + rel.x, a[1] + rel.y});
+            break;
+
+        case 'H': case 'h':
+            if (!number(a[0])) return false;
+            line(Point{a[0] + rel.x, current.y});
+            break;
+
+        case 'V': case 'v':
+            if (!number(a[0])) return false;
+            line(Point{current.x, a[0] + rel.y});
+            break;
+
+        case 'C': case 'c': case 'S': case 's': {
+            Segment seg;
+            seg.kind = SEG_CUBIC;
+            seg.p[0] = current;
+            bool smooth = command == 'S' || command == 's';
+            if (smooth) {
+                if (!number(a[2]) || !number(a[3]) || !number(a[4]) || !number(a[5])) return false;
+                seg.p[1] = last_kind == 'C' ? Point{2 * current.x - last_cubic.x, 2 * current.y - last_cubic.y} : current;
+            } else {
+                for (int k = 0; k < 6; k++)
+                    if (!number(a[k])) return false;
+                seg.p[1] = Point{a[0] + rel.x, a[1] + rel.y};
+            }
+            seg.p[2] = Point{a[2] + rel.x, a[3] + rel.y};
+            seg.p[3] = Point{a[4] + rel.x, a[5] + rel.y};
+            segments.push_back(seg);
+            last_cubic = seg.p[2];
+            current = seg.p[3];
+            kind = 'C';
+            break;
+        }
+
+        case 'Q': case 'q': case 'T': case 't': {
+            Segment seg;
+            seg.kind = SEG_QUAD;
+            seg.p[0] = current;
+            if (command == 'T' || command == 't') {
+                if (!number(a[2]) || !number(a[3])) return false;
+                seg.p[1] = last_kind == 'Q' ? Point{2 * current.x - last_quad.x, 2 * current.y - last_quad.y} : current;
+            } else {
+                for (int k = 0; k < 4; k++)
+                    if (!number(a[k])) return false;
+                seg.p[1] = Point{a[0] + rel.x, a[1] + rel.y};
+            }
+            seg.p[2] = Point{a[2] + rel.x, a[3] + rel.y};
+            segments.push_back(seg);
+            last_quad = seg.p[1];
+            current = seg.p[2];
+            kind = 'Q';
+            break;
+        }
+
+        case 'A': case 'a': {
+            for (int k = 0; k < 7; k++)
+                if (!number(a[k])) return false;
+            Point end{a[5] + rel.x, a[6] + rel.y};
+            // Zero radius arcs are drawn as lines
+            if (a[0] == 0 || a[1] == 0) {
+                line(end);
+                break;
+            }
+            Segment seg;
+            if (!make_arc(seg, current, a[0], a[1], a[2], a[3] != 0, a[4] != 0, end))
+                return false;
+            segments.push_back(seg);
+            current = end;
+            break;
+        }
+
+        default:
+            return false;
+        }
+        last_kind = kind;
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Sampling, see smart_sample_segment() and simplify_points()
+
+static int clamp_segments(double n) {
+    if (n < 1)
+        return 1;
+    return (int)std::min((double)FLATTEN_MAX_SEGMENTS, ceil(n));
+}
+
+static int arc_segments(double r, double sweep, double tol) {
+    sweep = fabs(sweep);
+    if (r <= tol)
+        return clamp_segments(sweep / (M_PI / 2));
+    return clamp_segments(sweep / (2 * acos(1 - tol / r)));
+}
+
+// Wang's formula over the control points
+static int bezier_segments(const Point* p, int count, double tol) {
+    double m = 0;
+    for (int i = 0; i + 2 < count; i++)
+        m = std::max(m, hypot(p[i].x - 2 * p[i + 1].x + p[i + 2].x, p[i].y - 2 * p[i + 1].y + p[i + 2].y));
+    int d = count - 1;
+    return clamp_segments(sqrt(d * (d - 1) / 8.0 * m / tol));
+}
+
+static bool is_collinear(Point a, Point b, Point c, double tolerance) {
+    return fabs((b.y - a.y) * (c.x - b.x) - (c.y - b.y) * (b.x - a.x)) < tolerance;
+}
+
+static std::vector<Point> simplify_points(const std::vector<Point>& points, double tolerance) {
+    if (points.size() <= 2)
+        return points;
+    std::vector<Point> out;
+    out.push_back(points[0]);
+    for (size_t i = 1; i + 1 < points.size(); i++) {
+        if (!is_collinear(out.back(), points[i], points[i + 1], tolerance))
+            out.push_back(points[i]);
+    }
+    out.push_back(points.back());
+    return out;
+}
+
+static std::vector<Point> sample_segment(const Segment& seg, double tolerance, double max_error) {
+    std::vector<Point> points;
+    if (seg.kind == SEG_LINE) {
+        points.push_back(seg.p[0]);
+        points.push_back(seg.p[1]);
+        return points;
+    }
+
+    int n;
+    if (seg.kind == SEG_ARC)
+        n = arc_segments(std::max(seg.rx, seg.ry), seg.delta * M_PI / 180, max_error);
+    else
+        n = bezier_segments(seg.p, seg.kind == SEG_QUAD ? 3 : 4, max_error);
+
+    for (int i = 0; i <= n; i++)
+        points.push_back(seg.point(i / (double)n));
+    return simplify_points(points, tolerance);
+}
+
+// smart_parse_path(), false if d doesn't parse
+static bool sample_path(const std::string& d, double tolerance, double max_error, std::vector<Point>& out) {
+    std::vector<Segment> segments;
+    if (!parse_path(d, segments))
+        return false;
+
+    std::vector<Point> all;
+    for (const Segment& seg : segments) {
+        std::vector<Point> pts = sample_segment(seg, tolerance, max_error);
+        size_t from = 0;
+        if (!all.empty() && fabs(all.back().x - pts[0].x) < 1e-6 && fabs(all.back().y - pts[0].y) < 1e-6)
+            from = 1;
+        all.insert(all.end(), pts.begin() + from, pts.end());
+    }
+    out = simplify_points(all, tolerance);
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// XML, just enough to walk the elements of an SVG in document order
+
+struct Element {
+    std::string tag;  // without namespace prefix
+    std::vector<std::pair<std::string, std::string>> attrs;
+
+    const std::string* get(const char* name) const {
+        for (const auto& a : attrs)
+            if (a.first == name)
+                return &a.second;
+        return NULL;
+    }
+};
+
+static std::string xml_unescape(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] != '&') {
+            out += s[i];
+            continue;
+        }
+        size_t semi = s.find(';', i);
+        if (semi == std::string::npos) {
+            out += s[i];
+            continue;
+        }
+        std::string name = s.substr(i + 1, semi - i - 1);
+        if (name == "amp") out += '&';
+        else if (name == "lt") out += '<';
+        else if (name == "gt") out += '>';
+        else if (name == "quot") out += '"';
+        else if (name == "apos") out += '\'';
+        else if (!name.empty() && name[0] == '#') {
+            long c = name.size() > 1 && (name[1] == 'x' || name[1] == 'X') ? strtol(name.c_str() + 2, NULL, 16) : strtol(name.c_str() + 1, NULL, 10);
+            // Only ASCII matters for the attributes we read
+            out += c > 0 && c < 128 ? (char)c : ' ';
+        } else {
+            out += s.substr(i, semi - i + 1);
+        }
+        i = semi;
+    }
+    return out;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool parse_xml(const std::string& xml, std::vector<Element>& elements) {
+    size_t i = 0;
+    while ((i = xml.find('<', i)) != std::string::npos) {
+        if (xml.compare(i, 4, "<!--") == 0) {
+            i = xml.find("-->", i);
+            if (i == std::string::npos) return false;
+            i += 3;
+            continue;
+        }
+        if (xml.compare(i, 9, "<![CDATA[") == 0) {
+            i = xml.find("]]>", i);
+            if (i == std::string::npos) return false;
+            i += 3;
+            continue;
+        }
+        if (xml.compare(i, 2, "<?") == 0 || xml.compare(i, 2, "<!") == 0 || xml.compare(i, 2, "</") == 0) {
+            i = xml.find('>', i);
+            if (i == std::string::npos) return false;
+            i++;
+            continue;
+        }
+
+        i++;
+        size_t name_start = i;
+        while (i < xml.size() && !is_space(xml[i]) && xml[i] != '>' && xml[i] != '/')
+            i++;
+        Element el;
+        el.tag = xml.substr(name_start, i - name_start);
+        size_t colon = el.tag.rfind(':');
+        if (colon != std::string::npos)
+            el.tag = el.tag.substr(colon + 1);
+
+        while (true) {
+            while (i < xml.size() && is_space(xml[i]))
+                i++;
+            if (i >= xml.size()) return false;
+            if (xml[i] == '>' || xml[i] == '/') {
+                i = xml.find('>', i);
+                if (i == std::string::npos) return false;
+                i++;
+                break;
+            }
+            size_t key_start = i;
+            while (i < xml.size() && xml[i] != '=' && !is_space(xml[i]) && xml[i] != '>')
+                i++;
+            std::string key = xml.substr(key_start, i - key_start);
+            while (i < xml.size() && is_space(xml[i]))
+                i++;
+            if (i >= xml.size() || xml[i] != '=') return false;
+            i++;
+            while (i < xml.size() && is_space(xml[i]))
+                i++;
+            if (i >= xml.size() || (xml[i] != '"' && xml[i] != '\'')) return false;
+            char quote = xml[i++];
+            size_t end = xml.find(quote, i);
+            if (end == std::string::npos) return false;
+            // Namespaced attributes (inkscape:label, ...) are never read
+            if (key.find(':') == std::string::npos)
+                el.attrs.push_back(std::make_pair(key, xml_unescape(xml.substr(i, end - i))));
+            i = end + 1;
+        }
+        elements.push_back(el);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// One SVG to lamp commands, see main() of svg_to_lamp_smartv2.py
+
+struct Converter {
+    double tolerance;
+    const std::vector<Element>& elements;
+
+    Converter(double tolerance, const std::vector<Element>& elements) : tolerance(tolerance), elements(elements) {}
+
+    // float() of an attribute, the whole file fails if it isn't a number
+    static bool attr(const Element& el, const char* name, double& v) {
+        const std::string* s = el.get(name);
+        if (s == NULL) {
+            v = 0;
+            return true;
+        }
+        const char* begin = s->c_str();
+        while (is_space(*begin)) begin++;
+        char* end;
+        v = strtod(begin, &end);
+        while (is_space(*end)) end++;
+        return end != begin && *end == 0;
+    }
+
+    static bool is_pin(const Element& el) {
+        const std::string* id = el.get("id");
+        if (id == NULL)
+            return false;
+        std::string lower = *id;
+        for (char& c : lower)
+            c = tolower((unsigned char)c);
+        return lower.find("pin") != std::string::npos;
+    }
+
+    // The coordinates of a points attribute, like re.findall(r'-?\d*\.?\d+')
+    static std::vector<double> point_list(const Element& el) {
+        std::vector<double> out;
+        const std::string* s = el.get("points");
+        if (s == NULL)
+            return out;
+        size_t i = 0;
+        while (i < s->size()) {
+            size_t n = (*s)[i] == '+' ? 0 : match_float(*s, i, true, false);
+            if (n > 0) {
+                out.push_back(strtod(s->substr(i, n).c_str(), NULL));
+                i += n;
+            } else {
+                i++;
+            }
+        }
+        return out;
+    }
+
+    double minx = INFINITY, miny = INFINITY, maxx = -INFINITY, maxy = -INFINITY;
+    double scale = 1;
+    int offset_x = 0, offset_y = 0;
+
+    void include(double x, double y) {
+        minx = std::min(minx, x);
+        maxx = std::max(maxx, x);
+        miny = std::min(miny, y);
+        maxy = std::max(maxy, y);
+    }
+
+    // collect_bounds()
+    bool bounds() {
+        for (const Element& el : elements) {
+            double a[4];
+            if (el.tag == "path") {
+                const std::string* d = el.get("d");
+                std::vector<Point> pts;
+                if (d == NULL || d->empty() || !sample_path(*d, 0.5, FLATTEN_TOLERANCE, pts))
+                    continue;
+                for (const Point& p : pts)
+                    include(p.x, p.y);
+            } else if (el.tag == "rect") {
+                if (!attr(el, "x", a[0]) || !attr(el, "y", a[1]) || !attr(el, "width", a[2]) || !attr(el, "height", a[3]))
+                    return false;
+                include(a[0], a[1]);
+                include(a[0] + a[2], a[1] + a[3]);
+            } else if (el.tag == "circle") {
+                if (!attr(el, "cx", a[0]) || !attr(el, "cy", a[1]) || !attr(el, "r", a[2]))
+                    return false;
+                include(a[0] - a[2], a[1] - a[2]);
+                include(a[0] + a[2], a[1] + a[2]);
+            } else if (el.tag == "line") {
+                if (!attr(el, "x1", a[0]) || !attr(el, "y1", a[1]) || !attr(el, "x2", a[2]) || !attr(el, "y2", a[3]))
+                    return false;
+                include(a[0], a[1]);
+                include(a[2], a[3]);
+            } else if (el.tag == "polyline" || el.tag == "polygon") {
+                std::vector<double> pts = point_list(el);
+                for (size_t k = 0; k < pts.size(); k++) {
+                    if (k % 2 == 0) {
+                        minx = std::min(minx, pts[k]);
+                        maxx = std::max(maxx, pts[k]);
+                    } else {
+                        miny = std::min(miny, pts[k]);
+                        maxy = std::max(maxy, pts[k]);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    std::string xy(double x, double y) {
+        int tx = (int)((x - minx) * scale + offset_x);
+        int ty = (int)((y - miny) * scale + offset_y);
+        tx = std::max(0, std::min(tx, SCREEN_WIDTH - 1));
+        ty = std::max(0, std::min(ty, SCREEN_HEIGHT - 1));
+        return std::to_string(tx) + " " + std::to_string(ty);
+    }
+
+    // false if the SVG has nothing to draw or can't be read
+    bool run(std::vector<std::string>& commands) {
+        if (!bounds() || minx == INFINITY)
+            return false;
+
+        double width = maxx - minx, height = maxy - miny;
+        if (width > 0 && height > 0) {
+            double sx = (SCREEN_WIDTH - 2 * AUTO_MARGIN) / width;
+            double sy = (SCREEN_HEIGHT - 2 * AUTO_MARGIN) / height;
+            scale = (int)std::max(1.0, std::min((double)MAX_AUTO_SCALE, std::min(sx, sy)));
+        }
+        offset_x = std::max(AUTO_MARGIN, (int)((SCREEN_WIDTH - width * scale) / 2));
+        offset_y = std::max(AUTO_MARGIN, (int)((SCREEN_HEIGHT - height * scale) / 2));
+
+        for (const Element& el : elements) {
+            double a[4];
+            bool pin = is_pin(el);
+            if (el.tag == "path") {
+                const std::string* d = el.get("d");
+                std::vector<Point> pts;
+                if (pin || d == NULL || d->empty())
+                    continue;
+                if (!sample_path(*d, tolerance, FLATTEN_TOLERANCE / scale, pts)) {
+                    fprintf(stderr, "Warning: Failed to parse path\n");
+                    continue;
+                }
+                if (pts.empty())
+                    continue;
+                commands.push_back("pen down " + xy(pts[0].x, pts[0].y));
+                for (size_t k = 1; k < pts.size(); k++)
+                    commands.push_back("pen move " + xy(pts[k].x, pts[k].y));
+                commands.push_back("pen up");
+            } else if (el.tag == "rect") {
+                if (pin)
+                    continue;
+                if (!attr(el, "x", a[0]) || !attr(el, "y", a[1]) || !attr(el, "width", a[2]) || !attr(el, "height", a[3]))
+                    return false;
+                commands.push_back("pen rectangle " + xy(a[0], a[1]) + " " + xy(a[0] + a[2], a[1] + a[3]));
+            } else if (el.tag == "circle") {
+                // Pin circles only mark anchors, they are never drawn
+                if (pin)
+                    continue;
+                if (!attr(el, "cx", a[0]) || !attr(el, "cy", a[1]) || !attr(el, "r", a[2]))
+                    return false;
+                commands.push_back("pen circle " + xy(a[0], a[1]) + " " + std::to_string((int)(a[2] * scale)));
+            } else if (el.tag == "line") {
+                if (pin)
+                    continue;
+                if (!attr(el, "x1", a[0]) || !attr(el, "y1", a[1]) || !attr(el, "x2", a[2]) || !attr(el, "y2", a[3]))
+                    return false;
+                commands.push_back("pen line " + xy(a[0], a[1]) + " " + xy(a[2], a[3]));
+            } else if (el.tag == "polyline" || el.tag == "polygon") {
+                if (pin)
+                    continue;
+                std::vector<double> pts = point_list(el);
+                if (pts.size() < 4)
+                    continue;
+                if (pts.size() % 2)
+                    return false;
+                commands.push_back("pen down " + xy(pts[0], pts[1]));
+                for (size_t k = 2; k < pts.size(); k += 2)
+                    commands.push_back("pen move " + xy(pts[k], pts[k + 1]));
+                if (el.tag == "polygon")
+                    commands.push_back("pen move " + xy(pts[0], pts[1]));
+                commands.push_back("pen up");
+            }
+        }
+        return !commands.empty();
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Stroke ordering, see optimize_strokes() in build_component_library.py
+
+typedef std::vector<std::pair<int, int>> Stroke;
+
+static int pen_ups(const std::vector<std::string>& commands) {
+    return std::count(commands.begin(), commands.end(), std::string("pen up"));
+}
+
+static bool near(const std::pair<int, int>& a, const std::pair<int, int>& b) {
+    return abs(a.first - b.first) <= JOIN_TOLERANCE && abs(a.second - b.second) <= JOIN_TOLERANCE;
+}
+
+static double dist(const std::pair<int, int>& a, const std::pair<int, int>& b) {
+    return hypot(a.first - b.first, a.second - b.second);
+}
+
+// Squared distance from w[i] to the segment w[a] w[b]
+static double segment_distance(const Stroke& w, size_t i, size_t a, size_t b) {
+    int64_t dx = (int64_t)w[b].first - w[a].first, dy = (int64_t)w[b].second - w[a].second;
+    int64_t px = (int64_t)w[i].first - w[a].first, py = (int64_t)w[i].second - w[a].second;
+    int64_t len2 = dx * dx + dy * dy;
+    int64_t t = px * dx + py * dy;
+    if (len2 == 0 || t <= 0)
+        return (double)(px * px + py * py);
+    if (t >= len2) {
+        int64_t qx = (int64_t)w[i].first - w[b].first, qy = (int64_t)w[i].second - w[b].second;
+        return (double)(qx * qx + qy * qy);
+    }
+    int64_t c = px * dy - py * dx;
+    return (double)(c * c) / (double)len2;
+}
+
+// The points of w Douglas-Peucker keeps
+static std::vector<bool> simplify_window(const Stroke& w, double limit) {
+    std::vector<bool> keep(w.size(), false);
+    keep.front() = keep.back() = true;
+    std::vector<std::pair<size_t, size_t>> stack(1, std::make_pair((size_t)0, w.size() - 1));
+    while (!stack.empty()) {
+        size_t a = stack.back().first, b = stack.back().second;
+        stack.pop_back();
+        size_t far = 0;
+        double far_d = limit;
+        for (size_t i = a + 1; i < b; i++) {
+            double d = segment_distance(w, i, a, b);
+            if (d > far_d) {
+                far = i;
+                far_d = d;
+            }
+        }
+        if (far == 0)
+            continue;
+        keep[far] = true;
+        stack.push_back(std::make_pair(far, b));
+        stack.push_back(std::make_pair(a, far));
+    }
+    return keep;
+}
+
+// Douglas-Peucker the way lamp's streaming Simplifier (lamp/simplify.cpy)
+// does, window for window, see simplify_stroke() in
+// build_component_library.py
+static Stroke simplify_stroke(const Stroke& points, double tolerance = SIMPLIFY_TOLERANCE) {
+    Stroke out;
+    if (points.empty())
+        return out;
+    double limit = tolerance * tolerance;
+    out.push_back(points[0]);
+    Stroke win(1, points[0]);
+    for (size_t k = 1; k < points.size(); k++) {
+        if (points[k] == win.back())
+            continue;
+        win.push_back(points[k]);
+        if (win.size() < SIMPLIFY_WINDOW)
+            continue;
+        std::vector<bool> keep = simplify_window(win, limit);
+        size_t last = 0;
+        for (size_t i = 1; i + 1 < win.size(); i++) {
+            if (keep[i]) {
+                out.push_back(win[i]);
+                last = i;
+            }
+        }
+        if (last == 0 || win.size() - 1 - last > SIMPLIFY_WINDOW / 2) {
+            out.push_back(win.back());
+            last = win.size() - 1;
+        }
+        win.erase(win.begin(), win.begin() + last);
+    }
+    if (win.size() > 1) {
+        std::vector<bool> keep = simplify_window(win, limit);
+        for (size_t i = 1; i < win.size(); i++)
+            if (keep[i])
+                out.push_back(win[i]);
+    }
+    return out;
+}
+
+// Joins strokes whose ends meet and simplifies them, orders the rest nearest
+// first and improves that with 2-opt, which may also reverse strokes.
+// Commands other than pen down/move/up keep their order after the strokes
+static std::vector<std::string> optimize_strokes(const std::vector<std::string>& commands) {
+    std::vector<Stroke> strokes;
+    std::vector<std::string> others;
+    Stroke current;
+    for (const std::string& cmd : commands) {
+        std::istringstream ss(cmd);
+        std::string tool, action;
+        int x, y;
+        ss >> tool >> action;
+        if (tool == "pen" && (action == "down" || action == "move") && (ss >> x >> y)) {
+            if (action == "down" && !current.empty()) {
+                strokes.push_back(current);
+                current.clear();
+            }
+            current.push_back(std::make_pair(x, y));
+        } else if (cmd == "pen up") {
+            if (!current.empty())
+                strokes.push_back(current);
+            current.clear();
+        } else {
+            others.push_back(cmd);
+        }
+    }
+    if (!current.empty())
+        strokes.push_back(current);
+
+    // Join strokes end to end until no two ends meet
+    bool joined = true;
+    while (joined) {
+        joined = false;
+        for (size_t i = 0; i < strokes.size() && !joined; i++) {
+            for (size_t j = 0; j < strokes.size() && !joined; j++) {
+                if (i == j)
+                    continue;
+                Stroke a = strokes[i], b = strokes[j];
+                if (near(a.back(), b.front())) {
+                    a.insert(a.end(), b.begin() + 1, b.end());
+                } else if (near(a.back(), b.back())) {
+                    a.insert(a.end(), b.rbegin() + 1, b.rend());
+                } else if (near(a.front(), b.back())) {
+                    b.insert(b.end(), a.begin() + 1, a.end());
+                    a = b;
+                } else if (near(a.front(), b.front())) {
+                    std::reverse(b.begin(), b.end());
+                    b.insert(b.end(), a.begin() + 1, a.end());
+                    a = b;
+                } else {
+                    continue;
+                }
+                strokes[i] = a;
+                strokes.erase(strokes.begin() + j);
+                joined = true;
+            }
+        }
+    }
+    for (size_t k = 0; k < strokes.size(); k++)
+        strokes[k] = simplify_stroke(strokes[k]);
+
+    // Nearest end first
+    std::vector<Stroke> order;
+    if (!strokes.empty()) {
+        order.push_back(strokes[0]);
+        strokes.erase(strokes.begin());
+    }
+    while (!strokes.empty()) {
+        std::pair<int, int> pos = order.back().back();
+        size_t best = 0;
+        double best_d = 0;
+        for (size_t k = 0; k < strokes.size(); k++) {
+            double d = std::min(dist(pos, strokes[k].front()), dist(pos, strokes[k].back()));
+            if (k == 0 || d < best_d) {
+                best = k;
+                best_d = d;
+            }
+        }
+        Stroke stroke = strokes[best];
+        strokes.erase(strokes.begin() + best);
+        if (dist(pos, stroke.front()) > dist(pos, stroke.back()))
+            std::reverse(stroke.begin(), stroke.end());
+        order.push_back(stroke);
+    }
+
+    // 2-opt: reversing order[i..j] (and every stroke in it) swaps the travel
+    // into i and out of j for travel into j's end and out of i's start
+    for (int pass = 0; pass < MAX_2OPT_PASSES; pass++) {
+        bool improved = false;
+        for (size_t i = 0; i < order.size(); i++) {
+            for (size_t j = i; j < order.size(); j++) {
+                double old_d = 0, new_d = 0;
+                if (i > 0) {
+                    old_d += dist(order[i - 1].back(), order[i].front());
+                    new_d += dist(order[i - 1].back(), order[j].back());
+                }
+                if (j + 1 < order.size()) {
+                    old_d += dist(order[j].back(), order[j + 1].front());
+                    new_d += dist(order[i].front(), order[j + 1].front());
+                }
+                if (new_d < old_d - 1e-9) {
+                    std::reverse(order.begin() + i, order.begin() + j + 1);
+                    for (size_t k = i; k <= j; k++)
+                        std::reverse(order[k].begin(), order[k].end());
+                    improved = true;
+                }
+            }
+        }
+        if (!improved)
+            break;
+    }
+
+    std::vector<std::string> out;
+    for (const Stroke& stroke : order) {
+        out.push_back("pen down " + std::to_string(stroke[0].first) + " " + std::to_string(stroke[0].second));
+        for (size_t k = 1; k < stroke.size(); k++)
+            out.push_back("pen move " + std::to_string(stroke[k].first) + " " + std::to_string(stroke[k].second));
+        out.push_back("pen up");
+    }
+    out.insert(out.end(), others.begin(), others.end());
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Jobs and the content hash cache
+
+struct Job {
+    int kind;
+    std::string name;    // component or glyph name
+    std::string source;  // file name
+    std::string path;
+    double tolerance;
+
+    bool ok = false;
+    bool cached = false;
+    std::vector<std::string> commands;
+    // Before optimize_strokes()
+    int pen_ups = 0;
+};
+
+static uint64_t fnv1a(const std::string& s, uint64_t h = 14695981039346656037ULL) {
+    for (unsigned char c : s) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static bool read_file(const std::string& path, std::string& out) {
+    std::ifstream f(path.c_str(), std::ios::binary);
+    if (!f)
+        return false;
+    std::stringstream ss;
+    ss << f.rdbuf();
+    out = ss.str();
+    return true;
+}
+
+static void convert_job(Job& job, const std::string& cache_dir, int worker) {
+    std::string svg;
+    if (!read_file(job.path, svg)) {
+        fprintf(stderr, "Error: can't read %s\n", job.path.c_str());
+        return;
+    }
+
+    char key[32];
+    std::string salt = std::string(CACHE_VERSION) + "\n" + std::to_string(job.tolerance) + "\n";
+    snprintf(key, sizeof(key), "%016llx", (unsigned long long)fnv1a(svg, fnv1a(salt)));
+    std::string cache_path = cache_dir.empty() ? "" : cache_dir + "/" + key + ".lamp";
+
+    std::string text;
+    if (!cache_path.empty() && read_file(cache_path, text)) {
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line))
+            if (!line.empty())
+                job.commands.push_back(line);
+        job.ok = job.cached = !job.commands.empty();
+        if (job.ok)
+            return;
+    }
+
+    std::vector<Element> elements;
+    if (!parse_xml(svg, elements)) {
+        fprintf(stderr, "Error converting %s: not well formed\n", job.source.c_str());
+        return;
+    }
+    Converter conv(job.tolerance, elements);
+    job.ok = conv.run(job.commands);
+    if (!job.ok || cache_path.empty())
+        return;
+
+    // Written aside and renamed so a concurrent or interrupted build never
+    // sees half a file
+    std::string tmp = cache_path + ".tmp" + std::to_string(getpid()) + "_" + std::to_string(worker);
+    FILE* f = fopen(tmp.c_str(), "w");
+    if (f == NULL)
+        return;
+    for (const std::string& cmd : job.commands)
+        fprintf(f, "%s\n", cmd.c_str());
+    if (fclose(f) != 0 || rename(tmp.c_str(), cache_path.c_str()) != 0)
+        unlink(tmp.c_str());
+}
+
+// The cache keeps the commands as converted, so they are reordered on the
+// way out whether they were cached or not
+static void run_job(Job& job, const std::string& cache_dir, int worker) {
+    convert_job(job, cache_dir, worker);
+    if (job.ok) {
+        job.pen_ups = pen_ups(job.commands);
+        job.commands = optimize_strokes(job.commands);
+    }
+}
+
+static std::vector<std::string> list_svgs(const std::string& dir) {
+    std::vector<std::string> names;
+    DIR* d = opendir(dir.c_str());
+    if (d == NULL)
+        return names;
+    while (struct dirent* e = readdir(d)) {
+        std::string name = e->d_name;
+        if (name.size() > 4 && name.compare(name.size() - 4, 4, ".svg") == 0)
+            names.push_back(name);
+    }
+    closedir(d);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+// ---------------------------------------------------------------------------
+// Output, the same JSON build_component_library.py writes plus the binary
+// library lamp mmaps
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = s[i];
+        char buf[16];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else if (c == '\t') {
+            out += "\\t";
+        } else if (c < 0x20) {
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else if (c < 0x80) {
+            out += c;
+        } else {
+            // Decode UTF-8 and escape it the way json.dump's ensure_ascii does
+            int extra = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : 1;
+            unsigned cp = c & (0x3f >> extra);
+            for (int k = 0; k < extra && i + 1 < s.size(); k++)
+                cp = (cp << 6) | (s[++i] & 0x3f);
+            if (cp >= 0x10000) {
+                cp -= 0x10000;
+                snprintf(buf, sizeof(buf), "\\u%04x\\u%04x", 0xd800 + (cp >> 10), 0xdc00 + (cp & 0x3ff));
+            } else {
+                snprintf(buf, sizeof(buf), "\\u%04x", cp);
+            }
+            out += buf;
+        }
+    }
+    return out + "\"";
+}
+
+static void write_table(std::ostream& out, const std::vector<const Job*>& jobs, int kind) {
+    std::vector<const Job*> table;
+    for (const Job* job : jobs)
+        if (job->kind == kind)
+            table.push_back(job);
+    if (table.empty()) {
+        out << "{}";
+        return;
+    }
+
+    out << "{\n";
+    for (size_t i = 0; i < table.size(); i++) {
+        const Job& job = *table[i];
+        out << "    " << json_string(job.name) << ": {\n";
+        out << "      \"type\": \"" << (kind == KIND_GLYPH ? "glyph" : "component") << "\",\n";
+        if (kind == KIND_GLYPH)
+            out << "      \"char\": " << json_string(job.name) << ",\n";
+        out << "      \"source\": " << json_string(job.source) << ",\n";
+        out << "      \"commands\": [\n";
+        for (size_t k = 0; k < job.commands.size(); k++)
+            out << "        " << json_string(job.commands[k]) << (k + 1 < job.commands.size() ? ",\n" : "\n");
+        out << "      ],\n";
+        out << "      \"command_count\": " << job.commands.size() << "\n";
+        out << "    }" << (i + 1 < table.size() ? ",\n" : "\n");
+    }
+    out << "  }";
+}
+
+// Closed polygon for a `pen circle`, roughly one vertex per 8px of arc
+static Stroke circle_points(double cx, double cy, double r) {
+    int n = std::max(12, std::min(90, (int)(2 * M_PI * r / 8)));
+    Stroke out;
+    for (int i = 0; i <= n; i++)
+        out.push_back(std::make_pair((int)nearbyint(cx + r * cos(2 * M_PI * i / n)),
+                                     (int)nearbyint(cy + r * sin(2 * M_PI * i / n))));
+    return out;
+}
+
+// commands_to_strokes(): pen commands flattened into polylines
+static std::vector<Stroke> commands_to_strokes(const std::vector<std::string>& commands) {
+    std::vector<Stroke> strokes;
+    Stroke current;
+    for (const std::string& cmd : commands) {
+        std::istringstream ss(cmd);
+        std::string tool, action;
+        ss >> tool >> action;
+        if (tool != "pen")
+            continue;
+        std::vector<double> v;
+        double x;
+        while (ss >> x)
+            v.push_back(x);
+
+        if (action == "down" && v.size() >= 2) {
+            if (current.size() > 1)
+                strokes.push_back(current);
+            current.assign(1, std::make_pair((int)v[0], (int)v[1]));
+        } else if (action == "move" && v.size() >= 2) {
+            current.push_back(std::make_pair((int)v[0], (int)v[1]));
+        } else if (action == "up") {
+            if (current.size() > 1)
+                strokes.push_back(current);
+            current.clear();
+        } else if (action == "line" && v.size() >= 4) {
+            Stroke s;
+            s.push_back(std::make_pair((int)v[0], (int)v[1]));
+            s.push_back(std::make_pair((int)v[2], (int)v[3]));
+            strokes.push_back(s);
+        } else if (action == "rectangle" && v.size() >= 4) {
+            int x1 = v[0], y1 = v[1], x2 = v[2], y2 = v[3];
+            Stroke s;
+            s.push_back(std::make_pair(x1, y1));
+            s.push_back(std::make_pair(x1, y2));
+            s.push_back(std::make_pair(x2, y2));
+            s.push_back(std::make_pair(x2, y1));
+            s.push_back(std::make_pair(x1, y1));
+            strokes.push_back(s);
+        } else if (action == "circle" && v.size() >= 3) {
+            strokes.push_back(circle_points(v[0], v[1], v[2]));
+        }
+    }
+    if (current.size() > 1)
+        strokes.push_back(current);
+    return strokes;
+}
+
+static void put16(std::string& out, int v) {
+    out += (char)(v & 0xff);
+    out += (char)((v >> 8) & 0xff);
+}
+
+static void put32(std::string& out, uint32_t v) {
+    put16(out, v & 0xffff);
+    put16(out, v >> 16);
+}
+
+// Spacing table for lamp's `text`, the same bytes as font_metrics() in
+// build_component_library.py (see there): u16 glyph count, i16 space
+// advance, i16 advance per glyph, i16 kerning matrix with the left glyph as
+// the row
+static std::string font_metrics(const std::vector<const std::vector<Stroke>*>& glyphs) {
+    int top = INT16_MAX, bottom = INT16_MIN;
+    for (const std::vector<Stroke>* strokes : glyphs)
+        for (const Stroke& s : *strokes)
+            for (const std::pair<int, int>& p : s) {
+                top = std::min(top, p.second);
+                bottom = std::max(bottom, p.second);
+            }
+    int height = bottom - top + 1;
+    int gap = height * 3 / 20;
+    int space = height / 2;
+
+    struct Profile {
+        int lo, hi;
+        int left[KERN_BANDS], right[KERN_BANDS];
+        bool inked[KERN_BANDS];
+    };
+    std::vector<Profile> profiles;
+    for (const std::vector<Stroke>* strokes : glyphs) {
+        Profile pr;
+        pr.lo = INT16_MAX;
+        pr.hi = INT16_MIN;
+        for (int b = 0; b < KERN_BANDS; b++)
+            pr.inked[b] = false;
+        for (const Stroke& s : *strokes) {
+            // A single point is a segment to itself
+            size_t segments = s.size() > 1 ? s.size() - 1 : 1;
+            for (size_t k = 0; k < segments; k++) {
+                const std::pair<int, int>& p0 = s[k];
+                const std::pair<int, int>& p1 = s[std::min(k + 1, s.size() - 1)];
+                int x1 = std::min(p0.first, p1.first), x2 = std::max(p0.first, p1.first);
+                int b1 = (std::min(p0.second, p1.second) - top) * KERN_BANDS / height;
+                int b2 = (std::max(p0.second, p1.second) - top) * KERN_BANDS / height;
+                for (int b = b1; b <= b2; b++) {
+                    pr.left[b] = pr.inked[b] ? std::min(pr.left[b], x1) : x1;
+                    pr.right[b] = pr.inked[b] ? std::max(pr.right[b], x2) : x2;
+                    pr.inked[b] = true;
+                }
+            }
+            for (const std::pair<int, int>& p : s) {
+                pr.lo = std::min(pr.lo, p.first);
+                pr.hi = std::max(pr.hi, p.first);
+            }
+        }
+        profiles.push_back(pr);
+    }
+
+    std::string out;
+    put16(out, glyphs.size());
+    put16(out, space);
+    for (const Profile& pr : profiles)
+        put16(out, pr.hi - pr.lo + gap);
+    for (const Profile& a : profiles) {
+        for (const Profile& b : profiles) {
+            int room = gap / 2;
+            for (int i = 0; i < KERN_BANDS; i++)
+                for (int j = std::max(0, i - 1); j < std::min(KERN_BANDS, i + 2); j++)
+                    if (a.inked[i] && b.inked[j])
+                        room = std::min(room, a.hi - a.right[i] + b.left[j] - b.lo);
+            put16(out, -room);
+        }
+    }
+    return out;
+}
+
+static bool write_binary(const std::string& path, const std::vector<const Job*>& jobs, int& count, size_t& size) {
+    struct Entry {
+        int kind;
+        std::string name;
+        std::vector<Stroke> strokes;
+    };
+    std::vector<Entry> entries;
+    for (const Job* job : jobs) {
+        if (job->name.size() >= LIBRARY_NAME_LEN) {
+            fprintf(stderr, "Warning: name too long for binary library: %s\n", job->name.c_str());
+            continue;
+        }
+        Entry e{job->kind, job->name, commands_to_strokes(job->commands)};
+        if (!e.strokes.empty())
+            entries.push_back(e);
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return a.kind != b.kind ? a.kind < b.kind : a.name < b.name;
+    });
+    std::vector<const std::vector<Stroke>*> glyphs;
+
+    // Sorts after every glyph, it has the highest kind
+    if (!entries.empty() && entries.back().kind == KIND_GLYPH) {
+        Entry metrics{KIND_METRICS, "font", {}};
+        entries.push_back(metrics);
+    }
+    for (const Entry& e : entries)
+        if (e.kind == KIND_GLYPH)
+            glyphs.push_back(&e.strokes);
+
+    uint32_t data_offset = LIBRARY_HEADER_SIZE + LIBRARY_ENTRY_SIZE * entries.size();
+    std::string table, data;
+    int font_x1 = INT16_MAX, font_y1 = INT16_MAX, font_x2 = INT16_MIN, font_y2 = INT16_MIN;
+    for (const Entry& e : entries) {
+        int min_x = INT16_MAX, min_y = INT16_MAX, max_x = INT16_MIN, max_y = INT16_MIN;
+        uint32_t offset = data_offset + data.size();
+        if (e.kind == KIND_METRICS) {
+            data += font_metrics(glyphs);
+            min_x = font_x1;
+            min_y = font_y1;
+            max_x = font_x2;
+            max_y = font_y2;
+        }
+        for (const Stroke& s : e.strokes) {
+            put16(data, s.size());
+            put16(data, s[0].first);
+            put16(data, s[0].second);
+            for (size_t k = 0; k < s.size(); k++) {
+                if (k > 0) {
+                    put16(data, s[k].first - s[k - 1].first);
+                    put16(data, s[k].second - s[k - 1].second);
+                }
+                min_x = std::min(min_x, s[k].first);
+                min_y = std::min(min_y, s[k].second);
+                max_x = std::max(max_x, s[k].first);
+                max_y = std::max(max_y, s[k].second);
+            }
+        }
+
+        if (e.kind == KIND_GLYPH) {
+            font_x1 = std::min(font_x1, min_x);
+            font_y1 = std::min(font_y1, min_y);
+            font_x2 = std::max(font_x2, max_x);
+            font_y2 = std::max(font_y2, max_y);
+        }
+
+        std::string name = e.name;
+        name.resize(LIBRARY_NAME_LEN, '\0');
+        table += name;
+        table += (char)e.kind;
+        table += (char)0;
+        put16(table, e.strokes.size());
+        put32(table, offset);
+        put16(table, min_x);
+        put16(table, min_y);
+        put16(table, max_x);
+        put16(table, max_y);
+    }
+
+    std::string header = LIBRARY_MAGIC;
+    put16(header, LIBRARY_VERSION);
+    put16(header, entries.size());
+    put32(header, data_offset);
+    put32(header, data_offset + data.size());
+
+    // Renamed over the old file so a lamp that has it mapped keeps reading
+    // valid data until it notices the rebuild and maps the new one
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    {
+        std::ofstream f(tmp.c_str(), std::ios::binary);
+        f << header << table << data;
+        if (!f.flush()) {
+            unlink(tmp.c_str());
+            return false;
+        }
+    }
+    if (rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    count = entries.size();
+    size = data_offset + data.size();
+    return true;
+}
+
+// "segoe path_X.svg" is the glyph for X
+static std::string glyph_name(const std::string& file) {
+    std::string stem = file.substr(0, file.size() - 4);
+    size_t us = stem.rfind('_');
+    return us == std::string::npos ? stem : stem.substr(us + 1);
+}
+
+static void usage() {
+    fprintf(stderr, "Usage: svg_compile [-j jobs] [--cache dir | --no-cache] <components_dir> <font_dir> <output.json>\n");
+    fprintf(stderr, "\nWrites output.json and the binary library output.bin next to it.\n");
+    fprintf(stderr, "Converted SVGs are cached by content in output.json.cache unless --cache says otherwise.\n");
+}
+
+int main(int argc, char** argv) {
+    int threads = std::thread::hardware_concurrency();
+    std::string cache_dir;
+    bool use_cache = true;
+    std::vector<std::string> args;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            cache_dir = argv[++i];
+        } else if (arg == "--no-cache") {
+            use_cache = false;
+        } else if (arg == "-h" || arg == "--help") {
+            usage();
+            return 0;
+        } else {
+            args.push_back(arg);
+        }
+    }
+    if (args.size() < 3) {
+        usage();
+        return 1;
+    }
+    threads = std::max(1, threads);
+
+    std::string output = args[2];
+    std::string binary = output;
+    size_t dot = binary.rfind('.');
+    if (dot != std::string::npos && binary.find('/', dot) == std::string::npos)
+        binary = binary.substr(0, dot);
+    binary += ".bin";
+
+    if (!use_cache) {
+        cache_dir.clear();
+    } else {
+        if (cache_dir.empty())
+            cache_dir = output + ".cache";
+        if (mkdir(cache_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Warning: can't create cache %s, building everything\n", cache_dir.c_str());
+            cache_dir.clear();
+        }
+    }
+
+    std::vector<Job> jobs;
+    for (int kind = KIND_COMPONENT; kind <= KIND_GLYPH; kind++) {
+        const std::string& dir = args[kind];
+        struct stat st;
+        if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            fprintf(stderr, "Error: %s directory not found: %s\n", kind == KIND_GLYPH ? "Font" : "Components", dir.c_str());
+            return 1;
+        }
+        std::vector<std::string> names = list_svgs(dir);
+        if (names.empty())
+            fprintf(stderr, "Warning: No SVG files found in %s\n", dir.c_str());
+        for (const std::string& name : names) {
+            Job job;
+            job.kind = kind;
+            job.source = name;
+            job.path = dir + "/" + name;
+            job.name = kind == KIND_GLYPH ? glyph_name(name) : name.substr(0, name.size() - 4);
+            job.tolerance = kind == KIND_GLYPH ? GLYPH_TOLERANCE : COMPONENT_TOLERANCE;
+            jobs.push_back(job);
+        }
+    }
+
+    std::atomic<size_t> next(0);
+    std::vector<std::thread> pool;
+    for (int t = 0; t < std::min<int>(threads, jobs.size()); t++) {
+        pool.push_back(std::thread([&, t]() {
+            for (size_t i; (i = next++) < jobs.size();)
+                run_job(jobs[i], cache_dir, t);
+        }));
+    }
+    for (std::thread& t : pool)
+        t.join();
+
+    // Later files with the same name replace earlier ones, like the dict
+    // the Python builder fills
+    std::vector<const Job*> done;
+    int counts[2] = {0, 0}, cached = 0, failed = 0;
+    for (const Job& job : jobs) {
+        if (!job.ok) {
+            fprintf(stderr, "  %s ✗ (failed)\n", job.source.c_str());
+            failed++;
+            continue;
+        }
+        cached += job.cached;
+        printf("  %s ✓ (%zu commands, pen ups %d -> %d)\n", job.source.c_str(), job.commands.size(), job.pen_ups, pen_ups(job.commands));
+        auto same = std::find_if(done.begin(), done.end(), [&](const Job* j) {
+            return j->kind == job.kind && j->name == job.name;
+        });
+        if (same != done.end()) {
+            *same = &job;
+        } else {
+            done.push_back(&job);
+            counts[job.kind]++;
+        }
+    }
+
+    std::ofstream json(output.c_str());
+    json << "{\n  \"components\": ";
+    write_table(json, done, KIND_COMPONENT);
+    json << ",\n  \"font\": ";
+    write_table(json, done, KIND_GLYPH);
+    json << ",\n  \"stats\": {\n";
+    json << "    \"component_count\": " << counts[KIND_COMPONENT] << ",\n";
+    json << "    \"glyph_count\": " << counts[KIND_GLYPH] << ",\n";
+    json << "    \"total_entries\": " << counts[KIND_COMPONENT] + counts[KIND_GLYPH] << "\n";
+    json << "  }\n}";
+    json.close();
+    if (!json) {
+        fprintf(stderr, "Error: can't write %s\n", output.c_str());
+        return 1;
+    }
+
+    int entry_count = 0;
+    size_t binary_size = 0;
+    if (!write_binary(binary, done, entry_count, binary_size)) {
+        fprintf(stderr, "Error: can't write %s\n", binary.c_str());
+        return 1;
+    }
+
+    printf("Library saved to: %s\n", output.c_str());
+    printf("Binary library saved to: %s (%d entries, %zu bytes)\n", binary.c_str(), entry_count, binary_size);
+    printf("Components: %d\n", counts[KIND_COMPONENT]);
+    printf("Glyphs: %d\n", counts[KIND_GLYPH]);
+    printf("Converted: %zu, cached: %d, failed: %d (%d threads)\n",
+           jobs.size() - cached - failed, cached, failed, std::max(1, std::min<int>(threads, jobs.size())));
+    return 0;
+}